@@ -0,0 +1,61 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+// Minimal micro-benchmark harness. Each kernel is timed over a fixed number of
+// repetitions after a warm-up pass and reported as ns/op and Mops/s.
+
+#include <chrono>
+#include <cstdio>
+#include <cstddef>
+
+namespace bench {
+
+// Keeps the compiler from discarding a computed value
+template <typename T>
+inline void do_not_optimize(const T& value) {
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+inline void clobber_memory() {
+    asm volatile("" : : : "memory");
+}
+
+struct result {
+    double ns_per_op;
+    double mops_per_s;
+};
+
+inline void print_header() {
+    std::printf("%-40s %14s %14s\n", "kernel", "ns/op", "Mops/s");
+}
+
+// Runs `fn` (which performs `ops_per_call` operations) until at least
+// `min_seconds` have elapsed, then prints and returns the per-op timing.
+template <typename F>
+result run(const char* name, std::size_t ops_per_call, F&& fn, double min_seconds = 0.25) {
+    using clock = std::chrono::steady_clock;
+
+    // Warm-up
+    fn();
+
+    std::size_t calls = 0;
+    auto start = clock::now();
+    double elapsed = 0;
+    do {
+        for (int i=0;i<8;i++)
+            fn();
+        calls += 8;
+        elapsed = std::chrono::duration<double>(clock::now() - start).count();
+    } while (elapsed < min_seconds);
+
+    double ops = static_cast<double>(calls) * ops_per_call;
+    result r;
+    r.ns_per_op = elapsed * 1e9 / ops;
+    r.mops_per_s = ops / elapsed * 1e-6;
+    std::printf("%-40s %14.3f %14.2f\n", name, r.ns_per_op, r.mops_per_s);
+    return r;
+}
+
+}
+
+#endif
@@ -0,0 +1,334 @@
+// Micro-benchmarks for the intersection, traversal and shading kernels.
+//
+//   kernel_bench [filter]
+//
+// Only kernels whose name contains filter are run. Inputs come from fixed
+// seeds, so every run times the same rays, scenes and texture lookups.
+
+#include "general.h"
+#include "aabb.h"
+#include "sphere.h"
+#include "moving_sphere.h"
+#include "aarect.h"
+#include "box.h"
+#include "bvh.h"
+#include "density_grid.h"
+#include "heterogeneous_medium.h"
+#include "hittable_list.h"
+#include "material.h"
+#include "perlin.h"
+#include "texture.h"
+#include "texture_bake.h"
+
+#include "bench.h"
+
+#include <cmath>
+#include <iostream>
+#include <string>
+#include <vector>
+
+static const int count = 1024;
+static std::string filter;
+
+static bool selected(const std::string& name) {
+    return filter.empty() || name.find(filter) != std::string::npos;
+}
+
+// Rays from a sphere of radius 4 aimed near the origin, so roughly half of
+// them hit a unit-sized object there
+static std::vector<ray> make_rays(unsigned seed) {
+    seed_random(seed);
+    std::vector<ray> rays;
+    rays.reserve(count);
+    for (int i=0;i<count;i++){
+        auto origin = 4 * unit_vector(vec3::random(-1, 1));
+        auto target = vec3::random(-1.5, 1.5);
+        rays.push_back(ray(origin, target - origin, random_double()));
+    }
+    return rays;
+}
+
+// Times hit() of one object over the shared ray set
+static void bench_hit(const std::string& name, const hittable& object, const std::vector<ray>& rays) {
+    if (!selected(name))
+        return;
+    bench::run(name.c_str(), rays.size(), [&]{
+        int hits = 0;
+        hit_record rec;
+        for (const auto& r : rays)
+            hits += object.hit(r, 0.001, infinity, rec);
+        bench::do_not_optimize(hits);
+    });
+}
+
+// n spheres of radius 0.4 in a cube whose volume grows with n, so the density
+// stays the same while the BVH gets deeper
+static hittable_list make_sphere_scene(int n, unsigned seed) {
+    seed_random(seed);
+    hittable_list scene;
+    auto mat = make_scene_shared<lambertian>(color(0.5, 0.5, 0.5));
+    auto extent = std::cbrt(static_cast<double>(n)) * 0.5;
+    for (int i=0;i<n;i++)
+        scene.add(make_scene_shared<sphere>(vec3::random(-1, 1) * extent, 0.4, mat));
+    return scene;
+}
+
+// Same ray pattern scaled to the extent of make_sphere_scene(n)
+static std::vector<ray> make_scene_rays(int n, unsigned seed) {
+    auto extent = std::cbrt(static_cast<double>(n)) * 0.5;
+    auto rays = make_rays(seed);
+    for (auto& r : rays)
+        r = ray(extent * r.origin(), r.direction(), r.time());
+    return rays;
+}
+
+// With use_arena the spheres and nodes are packed into a scene arena instead
+// of separate heap allocations
+static void bench_bvh(int n, unsigned seed, bool use_arena) {
+    auto name = "bvh_node::hit " + std::to_string(n) + " spheres" + (use_arena ? " arena" : "");
+    if (!selected(name))
+        return;
+
+    auto arena = scene_arena::create();
+    std::unique_ptr<scene_arena::scope> arena_scope(use_arena ? new scene_arena::scope(arena) : nullptr);
+    auto scene = make_sphere_scene(n, seed);
+    bvh_node bvh(scene, 0, 1);
+
+    bench_hit(name, bvh, make_scene_rays(n, seed + 1));
+}
+
+static void bench_compressed_bvh(int n, unsigned seed) {
+    auto name = "compressed_bvh::hit " + std::to_string(n) + " spheres";
+    if (!selected(name))
+        return;
+
+    auto arena = scene_arena::create();
+    scene_arena::scope arena_scope(arena);
+    auto scene = make_sphere_scene(n, seed);
+    compressed_bvh bvh(scene, 0, 1);
+
+    bench_hit(name, bvh, make_scene_rays(n, seed + 1));
+}
+
+// Hit records on a unit sphere, as a camera ray would leave them
+static std::vector<std::pair<ray, hit_record>> make_hits(unsigned seed) {
+    auto rays = make_rays(seed);
+    sphere target(point3(0, 0, 0), 1, nullptr);
+    std::vector<std::pair<ray, hit_record>> hits;
+    for (const auto& r : rays){
+        hit_record rec;
+        if (target.hit(r, 0.001, infinity, rec))
+            hits.emplace_back(r, rec);
+    }
+    return hits;
+}
+
+static void bench_scatter(const std::string& name, const material& mat, const std::vector<std::pair<ray, hit_record>>& hits) {
+    if (!selected(name))
+        return;
+    seed_random(7);
+    bench::run(name.c_str(), hits.size(), [&]{
+        int scattered_count = 0;
+        color attenuation;
+        ray scattered;
+        for (const auto& h : hits)
+            scattered_count += mat.scatter(h.first, h.second, attenuation, scattered);
+        bench::do_not_optimize(scattered_count);
+        bench::do_not_optimize(attenuation);
+    });
+}
+
+// Checks the ratio tracking transmittance and the delta tracking miss rate
+// against exp(-optical depth) from a quadrature of the grid's own density
+static bool check_transmittance() {
+    aabb bounds(point3(0, 0, 0), point3(1, 1, 1));
+    auto grid = dense_grid::from_function(bounds, 32, 32, 32, [](const point3& p) {
+        return 0.5 + p.x() + 0.5*p.z()*sin(6*p.y());
+    });
+    heterogeneous_medium medium(grid, 1.5, color(1, 1, 1), 8);
+
+    const ray paths[] = {
+        ray(point3(-0.5, 0.5, 0.5), vec3(2, 0, 0)),
+        ray(point3(-0.1, -0.2, -0.1), vec3(1.2, 1.3, 1.1)),
+        ray(point3(0.3, 1.5, 0.7), vec3(0.1, -0.5, -0.05)),
+    };
+
+    const int samples = 200000;
+    bool ok = true;
+    for (const auto& r : paths) {
+        double t_min = 0, t_max = infinity;
+        if (!bounds.clip(r, t_min, t_max))
+            continue;
+
+        const int steps = 100000;
+        auto dt = (t_max - t_min) / steps;
+        double depth = 0;
+        for (int i=0;i<steps;i++)
+            depth += grid->density(r.at(t_min + (i+0.5)*dt));
+        auto exact = exp(-depth * dt * medium.density_scale * r.direction().length());
+
+        double sum = 0, sum_sq = 0;
+        int misses = 0;
+        hit_record rec;
+        for (int i=0;i<samples;i++) {
+            auto T = medium.transmittance(r, 0, infinity);
+            sum += T;
+            sum_sq += T*T;
+            if (!medium.hit(r, 0, infinity, rec))
+                misses++;
+        }
+        auto ratio = sum / samples;
+        auto ratio_error = sqrt(fmax(sum_sq/samples - ratio*ratio, 0) / samples);
+        auto delta = static_cast<double>(misses) / samples;
+        auto delta_error = sqrt(exact*(1-exact) / samples);
+
+        bool pass = fabs(ratio - exact) < 4*ratio_error + 1e-4
+                 && fabs(delta - exact) < 4*delta_error + 1e-4;
+        std::printf("transmittance exact %.4f ratio tracking %.4f delta tracking %.4f %s\n",
+                    exact, ratio, delta, pass ? "ok" : "MISMATCH");
+        ok = ok && pass;
+    }
+    return ok;
+}
+
+int main(int argc, char** argv) {
+    if (argc > 1)
+        filter = argv[1];
+
+    bench::print_header();
+
+    auto rays = make_rays(1);
+    auto mat = make_shared<lambertian>(color(0.5, 0.5, 0.5));
+
+    // Primitives
+    if (selected("aabb::hit")) {
+        aabb bounds(point3(-1, -1, -1), point3(1, 1, 1));
+        bench::run("aabb::hit", rays.size(), [&]{
+            int hits = 0;
+            for (const auto& r : rays)
+                hits += bounds.hit(r, 0.001, infinity);
+            bench::do_not_optimize(hits);
+        });
+    }
+    bench_hit("sphere::hit", sphere(point3(0, 0, 0), 1, mat), rays);
+    bench_hit("moving_sphere::hit", moving_sphere(point3(0, -0.5, 0), point3(0, 0.5, 0), 0, 1, 1, mat), rays);
+    bench_hit("xy_rect::hit", xy_rect(-1, 1, -1, 1, 0, mat), rays);
+    bench_hit("xz_rect::hit", xz_rect(-1, 1, -1, 1, 0, mat), rays);
+    bench_hit("yz_rect::hit", yz_rect(-1, 1, -1, 1, 0, mat), rays);
+    bench_hit("box::hit", box(point3(-1, -1, -1), point3(1, 1, 1), mat), rays);
+
+    // Traversal. Larger scenes are left out for bvh_node because its build
+    // copies the object list at every node; compressed_bvh sorts in place.
+    for (int n : {16, 256, 4096})
+        for (bool use_arena : {false, true})
+            bench_bvh(n, 2, use_arena);
+    for (int n : {16, 256, 4096, 65536})
+        bench_compressed_bvh(n, 2);
+
+    // Shading
+    auto hits = make_hits(3);
+    bench_scatter("lambertian::scatter", lambertian(color(0.5, 0.5, 0.5)), hits);
+    bench_scatter("lambertian::scatter checker", lambertian(make_shared<checker_texture>(color(0, 0, 0), color(1, 1, 1))), hits);
+    bench_scatter("metal::scatter", metal(color(0.8, 0.8, 0.8), 0.3), hits);
+    bench_scatter("dielectric::scatter", dielectric(1.5), hits);
+    bench_scatter("diffuse_light::scatter", diffuse_light(color(4, 4, 4)), hits);
+    bench_scatter("isotropic::scatter", isotropic(color(0.5, 0.5, 0.5)), hits);
+
+    // Textures
+    seed_random(4);
+    std::vector<point3> points(count);
+    std::vector<double> us(count), vs(count);
+    for (int i=0;i<count;i++){
+        points[i] = vec3::random(-4, 4);
+        us[i] = random_double();
+        vs[i] = random_double();
+    }
+
+    perlin noise;
+    if (selected("perlin::noise"))
+        bench::run("perlin::noise", count, [&]{
+            double sum = 0;
+            for (const auto& p : points)
+                sum += noise.noise(p);
+            bench::do_not_optimize(sum);
+        });
+    if (selected("perlin::turbulance"))
+        bench::run("perlin::turbulance", count, [&]{
+            double sum = 0;
+            for (const auto& p : points)
+                sum += noise.turbulance(p);
+            bench::do_not_optimize(sum);
+        });
+
+    if (selected("image_texture::value")) {
+        // Generated in memory so the benchmark needs no image files
+        const int size = 512;
+        std::vector<float> pixels(static_cast<size_t>(size)*size*3);
+        for (size_t i=0;i<pixels.size();i++)
+            pixels[i] = static_cast<float>(random_double());
+        image_texture image;
+        image.load_pixels(pixels.data(), size, size);
+
+        bench::run("image_texture::value", count, [&]{
+            color sum(0, 0, 0);
+            for (int i=0;i<count;i++)
+                sum += image.value(us[i], vs[i], points[i]);
+            bench::do_not_optimize(sum);
+        });
+        bench::run("image_texture::value footprint", count, [&]{
+            color sum(0, 0, 0);
+            for (int i=0;i<count;i++)
+                sum += image.value(us[i], vs[i], points[i], 1.0 / 64);
+            bench::do_not_optimize(sum);
+        });
+    }
+
+    // Baking a marble noise over a unit sphere, per texel, and lookups into the result
+    {
+        auto marble = make_shared<noise_texture>(4);
+        sphere surface(point3(0, 0, 0), 1, nullptr);
+        const int width = 256, height = 128;
+        if (selected("bake_texture noise 256x128"))
+            bench::run("bake_texture noise 256x128", width*height, [&]{
+                bench::do_not_optimize(bake_texture(marble, surface, width, height));
+            });
+
+        if (selected("noise_texture::value"))
+            bench::run("noise_texture::value", count, [&]{
+                color sum(0, 0, 0);
+                for (int i=0;i<count;i++)
+                    sum += marble->value(us[i], vs[i], surface.surface_point(us[i], vs[i]));
+                bench::do_not_optimize(sum);
+            });
+        if (selected("image_texture::value baked noise")) {
+            auto baked = bake_texture(marble, surface, width, height);
+            bench::run("image_texture::value baked noise", count, [&]{
+                color sum(0, 0, 0);
+                for (int i=0;i<count;i++)
+                    sum += baked->value(us[i], vs[i], surface.surface_point(us[i], vs[i]));
+                bench::do_not_optimize(sum);
+            });
+        }
+    }
+
+    // Media
+    if (selected("transmittance check") && !check_transmittance()) {
+        std::cerr << "ERROR: heterogeneous_medium transmittance does not match exp(-optical depth)\n";
+        return 1;
+    }
+    if (selected("heterogeneous_medium::transmittance")) {
+        aabb bounds(point3(-1, -1, -1), point3(1, 1, 1));
+        auto grid = dense_grid::from_function(bounds, 32, 32, 32, [](const point3& p) {
+            return fmax(0.0, 1 - p.length());
+        });
+        heterogeneous_medium medium(grid, 2, color(1, 1, 1));
+        bench::run("heterogeneous_medium::transmittance", rays.size(), [&]{
+            double sum = 0;
+            for (const auto& r : rays)
+                sum += medium.transmittance(r, 0.001, infinity);
+            bench::do_not_optimize(sum);
+        });
+    }
+
+    return 0;
+}
@@ -0,0 +1,335 @@
+// End-to-end render regression harness. Renders the built-in scenes at a fixed
+// seed, size and sample count on 1 to N threads and reports wall time, rays
+// per second, parallel efficiency and the error against a reference image.
+//
+//   render_regression [--scenes a,b,...] [--width w] [--spp n] [--threads n] [--seed s] [--repeat n]
+//                     [--references dir] [--update-references] [--reference-spp n]
+//                     [--baseline file] [--output file]
+//                     [--time-tolerance f] [--quality-tolerance f] [--compressed-bvh] [--bake dir]
+//
+// References are <dir>/<scene>.pfm, rendered with --update-references at
+// --reference-spp (16x --spp by default) and a different seed. Each time is the
+// best of --repeat renders. Results are
+// written as JSON, one run per line; an earlier results file can be passed as
+// --baseline, and runs that got slower or noisier than it by more than the
+// tolerances are flagged. The exit status is 1 when anything was flagged.
+// --compressed-bvh builds the scenes' BVHs as compressed_bvh, and --bake bakes
+// their procedural textures into images cached in dir.
+
+#include "general.h"
+#include "scenes.h"
+#include "renderer.h"
+#include "framebuffer.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+struct options {
+    std::vector<std::string> scenes = {"random_scene", "cornell_box", "cornell_smoke", "final_scene"};
+    int width = 160;
+    int samples_per_pixel = 16;
+    unsigned max_threads = thread_pool::default_thread_count();
+    uint64_t seed = 1;
+    int repeat = 3;
+    std::string reference_dir = "regression";
+    bool update_references = false;
+    int reference_spp = 0;
+    std::string baseline;
+    std::string output = "regression.json";
+    double time_tolerance = 0.10;       // relative
+    double quality_tolerance = 0.05;    // relative
+    bool compressed_bvh = false;
+    std::string bake_dir;
+};
+
+struct run_result {
+    std::string scene;
+    unsigned threads = 0;
+    double seconds = 0;
+    double rays_per_second = 0;
+    double efficiency = 0;      // single-thread time / (threads * time)
+    double rmse = -1;           // -1 without a reference
+    double relmse = -1;
+    bool deterministic = true;  // same image as on one thread
+    std::string flags;
+};
+
+static int usage() {
+    std::cerr << "usage: render_regression [--scenes a,b,...] [--width w] [--spp n] [--threads n] [--seed s] [--repeat n]\n"
+                 "                         [--references dir] [--update-references] [--reference-spp n]\n"
+                 "                         [--baseline file] [--output file]\n"
+                 "                         [--time-tolerance f] [--quality-tolerance f] [--compressed-bvh] [--bake dir]\n";
+    return 2;
+}
+
+static std::vector<std::string> split(const std::string& s, char sep) {
+    std::vector<std::string> parts;
+    std::stringstream in(s);
+    std::string part;
+    while (std::getline(in, part, sep))
+        if (!part.empty())
+            parts.push_back(part);
+    return parts;
+}
+
+static bool parse_options(int argc, char** argv, options& opt) {
+    for (int i=1;i<argc;i++){
+        std::string arg = argv[i];
+        bool has_value = i+1 < argc;
+        if (arg == "--update-references")
+            opt.update_references = true;
+        else if (arg == "--compressed-bvh")
+            opt.compressed_bvh = true;
+        else if (!has_value)
+            return false;
+        else if (arg == "--scenes")
+            opt.scenes = split(argv[++i], ',');
+        else if (arg == "--width")
+            opt.width = std::atoi(argv[++i]);
+        else if (arg == "--spp")
+            opt.samples_per_pixel = std::atoi(argv[++i]);
+        else if (arg == "--threads")
+            opt.max_threads = static_cast<unsigned>(std::atoi(argv[++i]));
+        else if (arg == "--seed")
+            opt.seed = std::strtoull(argv[++i], nullptr, 10);
+        else if (arg == "--repeat")
+            opt.repeat = std::atoi(argv[++i]);
+        else if (arg == "--references")
+            opt.reference_dir = argv[++i];
+        else if (arg == "--reference-spp")
+            opt.reference_spp = std::atoi(argv[++i]);
+        else if (arg == "--baseline")
+            opt.baseline = argv[++i];
+        else if (arg == "--bake")
+            opt.bake_dir = argv[++i];
+        else if (arg == "--output")
+            opt.output = argv[++i];
+        else if (arg == "--time-tolerance")
+            opt.time_tolerance = std::atof(argv[++i]);
+        else if (arg == "--quality-tolerance")
+            opt.quality_tolerance = std::atof(argv[++i]);
+        else
+            return false;
+    }
+    if (opt.reference_spp <= 0)
+        opt.reference_spp = 16*opt.samples_per_pixel;
+    return opt.width > 1 && opt.samples_per_pixel > 0 && opt.max_threads > 0 && opt.repeat > 0;
+}
+
+// 1, 2, 4, ... up to and including max_threads
+static std::vector<unsigned> thread_counts(unsigned max_threads) {
+    std::vector<unsigned> counts;
+    for (unsigned n=1;n<max_threads;n*=2)
+        counts.push_back(n);
+    counts.push_back(max_threads);
+    return counts;
+}
+
+// A scene with its camera and BVH, ready to render repeatedly
+struct prepared_scene {
+    shared_ptr<scene_arena> arena = scene_arena::create();
+    scene_setup setup;
+    shared_ptr<camera> cam;
+    shared_ptr<scene_bvh> bvh;
+    int width, height;
+
+    prepared_scene(int id, int w, uint64_t seed, bool compressed_bvh, const std::string& bake_dir) : width(w) {
+        scene_arena::scope arena_scope(arena);
+        seed_random(seed);
+        setup = select_scene(id, bake_dir.empty() ? nullptr : bake_dir.c_str());
+        texture_registry::global().load_pending();
+        height = static_cast<int>(width / setup.aspect_ratio);
+
+        cam = make_shared<camera>(
+            setup.lookfrom, setup.lookat, vec3(0,1,0), setup.vfov, setup.aspect_ratio, setup.aperture, 10.0, 0.0, 1.0);
+        cam->set_resolution(height);
+
+        flatten_transforms(setup.world);
+        if (compressed_bvh)
+            compress_bvhs(setup.world);
+        bvh = make_shared<scene_bvh>(setup.world, cam->time0, cam->time1, compressed_bvh);
+    }
+
+    framebuffer render(const render_settings& settings, uint64_t* rays = nullptr, double* seconds = nullptr) const {
+        renderer r(*cam, *bvh, setup.background, setup.fog.get(), width, height, settings);
+        auto start = std::chrono::steady_clock::now();
+        auto image = r.render();
+        if (seconds)
+            *seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if (rays)
+            *rays = r.rays_traced();
+        return image;
+    }
+};
+
+// Root mean squared error and mean relative squared error, over all channels
+static void image_error(const framebuffer& image, const framebuffer& reference, double& rmse, double& relmse) {
+    double sum_sq = 0, sum_rel = 0;
+    for (size_t i=0;i<image.pixels.size();i++){
+        double d = image.pixels[i] - reference.pixels[i];
+        double r = reference.pixels[i];
+        sum_sq += d*d;
+        sum_rel += d*d / (r*r + 1e-2);
+    }
+    auto n = static_cast<double>(image.pixels.size());
+    rmse = std::sqrt(sum_sq / n);
+    relmse = sum_rel / n;
+}
+
+static bool file_exists(const std::string& path) {
+    return static_cast<bool>(std::ifstream(path));
+}
+
+static std::string to_json(const run_result& r) {
+    char line[512];
+    std::snprintf(line, sizeof(line),
+        "{\"scene\": \"%s\", \"threads\": %u, \"seconds\": %.6f, \"rays_per_second\": %.1f, \"efficiency\": %.4f, "
+        "\"rmse\": %.8g, \"relmse\": %.8g, \"deterministic\": %s, \"flags\": \"%s\"}",
+        r.scene.c_str(), r.threads, r.seconds, r.rays_per_second, r.efficiency,
+        r.rmse, r.relmse, r.deterministic ? "true" : "false", r.flags.c_str());
+    return line;
+}
+
+// Reads the runs of a results file written by this tool, keyed by scene and
+// thread count
+static bool read_baseline(const std::string& path, std::map<std::pair<std::string, unsigned>, run_result>& runs) {
+    std::ifstream in(path);
+    if (!in) {
+        std::cerr << "ERROR: Could not open baseline '" << path << "'.\n";
+        return false;
+    }
+    std::string line;
+    while (std::getline(in, line)) {
+        auto start = line.find('{');
+        if (start == std::string::npos || line.find("\"scene\"") == std::string::npos)
+            continue;
+        run_result r;
+        char scene[128];
+        if (std::sscanf(line.c_str() + start,
+                "{\"scene\": \"%127[^\"]\", \"threads\": %u, \"seconds\": %lf, \"rays_per_second\": %lf, "
+                "\"efficiency\": %lf, \"rmse\": %lf, \"relmse\": %lf",
+                scene, &r.threads, &r.seconds, &r.rays_per_second, &r.efficiency, &r.rmse, &r.relmse) != 7)
+            continue;
+        r.scene = scene;
+        runs[{r.scene, r.threads}] = r;
+    }
+    return true;
+}
+
+int main(int argc, char** argv) {
+    options opt;
+    if (!parse_options(argc, argv, opt))
+        return usage();
+
+    std::map<std::pair<std::string, unsigned>, run_result> baseline;
+    if (!opt.baseline.empty() && !read_baseline(opt.baseline, baseline))
+        return 2;
+
+    std::vector<run_result> results;
+    bool flagged = false;
+
+    std::printf("%-16s %7s %10s %10s %10s %12s %12s  %s\n",
+        "scene", "threads", "seconds", "Mrays/s", "efficiency", "rmse", "relmse", "flags");
+
+    for (const auto& name : opt.scenes) {
+        int id = scene_id(name);
+        if (id < 0) {
+            std::cerr << "ERROR: Unknown scene '" << name << "'.\n";
+            return 2;
+        }
+        prepared_scene scene(id, opt.width, opt.seed, opt.compressed_bvh, opt.bake_dir);
+
+        render_settings settings;
+        settings.samples_per_pixel = opt.samples_per_pixel;
+        settings.seed = opt.seed;
+
+        auto reference_path = opt.reference_dir + "/" + name + ".pfm";
+        if (opt.update_references) {
+            render_settings reference_settings = settings;
+            reference_settings.samples_per_pixel = opt.reference_spp;
+            reference_settings.seed = opt.seed + 1;
+            std::error_code ignored;
+            std::filesystem::create_directories(opt.reference_dir, ignored);
+            if (!scene.render(reference_settings).save(reference_path))
+                return 2;
+        }
+
+        framebuffer reference;
+        bool has_reference = file_exists(reference_path) && reference.load_pfm(reference_path)
+                          && reference.width == scene.width && reference.height == scene.height;
+        if (!has_reference)
+            std::cerr << "No reference for " << name << " at " << scene.width << "x" << scene.height
+                      << " in '" << opt.reference_dir << "'.\n";
+
+        framebuffer single_thread;
+        double single_thread_seconds = 0;
+
+        for (unsigned threads : thread_counts(opt.max_threads)) {
+            settings.thread_count = threads;
+
+            run_result r;
+            r.scene = name;
+            r.threads = threads;
+            uint64_t rays = 0;
+            auto image = scene.render(settings, &rays, &r.seconds);
+            for (int i=1;i<opt.repeat;i++){
+                double seconds;
+                scene.render(settings, nullptr, &seconds);
+                r.seconds = std::min(r.seconds, seconds);
+            }
+            r.rays_per_second = rays / r.seconds;
+
+            if (threads == 1) {
+                single_thread = image;
+                single_thread_seconds = r.seconds;
+            }
+            r.efficiency = single_thread_seconds / (threads * r.seconds);
+            r.deterministic = image.pixels == single_thread.pixels;
+            if (has_reference)
+                image_error(image, reference, r.rmse, r.relmse);
+
+            if (!r.deterministic)
+                r.flags += "nondeterministic ";
+            auto base = baseline.find({name, threads});
+            if (base != baseline.end()) {
+                if (r.seconds > base->second.seconds * (1 + opt.time_tolerance))
+                    r.flags += "slower ";
+                if (r.rmse >= 0 && base->second.rmse >= 0
+                    && r.rmse > base->second.rmse * (1 + opt.quality_tolerance) + 1e-9)
+                    r.flags += "quality ";
+            }
+            if (!r.flags.empty()) {
+                r.flags.pop_back();
+                flagged = true;
+            }
+
+            std::printf("%-16s %7u %10.3f %10.3f %10.3f %12.6g %12.6g  %s\n",
+                r.scene.c_str(), r.threads, r.seconds, r.rays_per_second * 1e-6, r.efficiency,
+                r.rmse, r.relmse, r.flags.c_str());
+            std::fflush(stdout);
+            results.push_back(r);
+        }
+    }
+
+    std::ofstream out(opt.output);
+    if (!out) {
+        std::cerr << "ERROR: Could not write '" << opt.output << "'.\n";
+        return 2;
+    }
+    out << "{\n  \"width\": " << opt.width << ", \"spp\": " << opt.samples_per_pixel << ", \"seed\": " << opt.seed
+        << ",\n  \"runs\": [\n";
+    for (size_t i=0;i<results.size();i++)
+        out << "    " << to_json(results[i]) << (i+1 < results.size() ? ",\n" : "\n");
+    out << "  ]\n}\n";
+
+    return flagged ? 1 : 0;
+}
@@ -0,0 +1,137 @@
+// Compares the SIMD-backed vec3 against the original scalar three-double layout.
+
+#include "general.h"
+#include "aabb.h"
+
+#include "bench.h"
+
+#include <string>
+#include <vector>
+
+// The previous vec3: three doubles, one scalar operation per component.
+namespace legacy {
+
+struct vec3 {
+    double e[3];
+
+    vec3() : e{0, 0, 0} {}
+    vec3(double e0, double e1, double e2) : e{e0, e1, e2} {}
+
+    double operator[](int i) const { return e[i]; }
+};
+
+inline vec3 operator+(const vec3& u, const vec3& v) { return vec3(u.e[0]+v.e[0], u.e[1]+v.e[1], u.e[2]+v.e[2]); }
+inline vec3 operator-(const vec3& u, const vec3& v) { return vec3(u.e[0]-v.e[0], u.e[1]-v.e[1], u.e[2]-v.e[2]); }
+inline vec3 operator*(const vec3& u, const vec3& v) { return vec3(u.e[0]*v.e[0], u.e[1]*v.e[1], u.e[2]*v.e[2]); }
+inline vec3 operator*(double t, const vec3& u) { return vec3(t*u.e[0], t*u.e[1], t*u.e[2]); }
+
+inline double dot(const vec3& v, const vec3& u) { return v.e[0]*u.e[0] + v.e[1]*u.e[1] + v.e[2]*u.e[2]; }
+
+inline vec3 cross(const vec3& u, const vec3& v) {
+    return vec3(u.e[1] * v.e[2] - u.e[2] * v.e[1],
+                u.e[2] * v.e[0] - u.e[0] * v.e[2],
+                u.e[0] * v.e[1] - u.e[1] * v.e[0]);
+}
+
+inline vec3 vmin(const vec3& u, const vec3& v) { return vec3(fmin(u.e[0], v.e[0]), fmin(u.e[1], v.e[1]), fmin(u.e[2], v.e[2])); }
+inline vec3 vmax(const vec3& u, const vec3& v) { return vec3(fmax(u.e[0], v.e[0]), fmax(u.e[1], v.e[1]), fmax(u.e[2], v.e[2])); }
+
+inline vec3 unit_vector(const vec3& v) { return (1/sqrt(dot(v, v))) * v; }
+
+// The previous per-axis slab test from aabb::hit
+inline bool slab_hit(const vec3& mn, const vec3& mx, const vec3& orig, const vec3& dir, double t_min, double t_max) {
+    for (int i=0;i<3;i++){
+        auto invD = 1.0f/dir[i];
+        auto t0 = (mn[i]-orig[i]) * invD;
+        auto t1 = (mx[i]-orig[i]) * invD;
+        if (invD < 0.0f)
+            std::swap(t0, t1);
+        t_min = t0 > t_min ? t0 : t_min;
+        t_max = t1 < t_max ? t1 : t_max;
+        if (t_max <= t_min)
+            return false;
+    }
+    return true;
+}
+
+}
+
+static const int count = 1024;
+
+template <typename V>
+static std::vector<V> make_vectors(unsigned seed) {
+    seed_random(seed);
+    std::vector<V> out;
+    out.reserve(count);
+    for (int i=0;i<count;i++)
+        out.push_back(V(random_double(-1, 1), random_double(-1, 1), random_double(-1, 1)));
+    return out;
+}
+
+template <typename V>
+static void run_kernels(const char* tag) {
+    auto a = make_vectors<V>(1);
+    auto b = make_vectors<V>(2);
+    std::vector<V> out(count);
+    std::string prefix(tag);
+
+    bench::run((prefix + " add").c_str(), count, [&]{
+        for (int i=0;i<count;i++) out[i] = a[i] + b[i];
+        bench::clobber_memory();
+    });
+    bench::run((prefix + " mul").c_str(), count, [&]{
+        for (int i=0;i<count;i++) out[i] = a[i] * b[i];
+        bench::clobber_memory();
+    });
+    bench::run((prefix + " dot").c_str(), count, [&]{
+        double sum = 0;
+        for (int i=0;i<count;i++) sum += dot(a[i], b[i]);
+        bench::do_not_optimize(sum);
+    });
+    bench::run((prefix + " cross").c_str(), count, [&]{
+        for (int i=0;i<count;i++) out[i] = cross(a[i], b[i]);
+        bench::clobber_memory();
+    });
+    bench::run((prefix + " min/max").c_str(), count, [&]{
+        for (int i=0;i<count;i++) out[i] = vmax(vmin(a[i], b[i]), out[i]);
+        bench::clobber_memory();
+    });
+    bench::run((prefix + " unit_vector").c_str(), count, [&]{
+        for (int i=0;i<count;i++) out[i] = unit_vector(a[i]);
+        bench::clobber_memory();
+    });
+}
+
+int main() {
+    bench::print_header();
+
+    run_kernels<legacy::vec3>("scalar vec3");
+    run_kernels<vec3>("simd vec3");
+
+    // Slab test against a unit box from random origins
+    auto origins = make_vectors<vec3>(3);
+    auto dirs = make_vectors<vec3>(4);
+    for (auto& o : origins) o *= 4;
+
+    std::vector<legacy::vec3> l_origins, l_dirs;
+    for (int i=0;i<count;i++) {
+        l_origins.push_back(legacy::vec3(origins[i].x(), origins[i].y(), origins[i].z()));
+        l_dirs.push_back(legacy::vec3(dirs[i].x(), dirs[i].y(), dirs[i].z()));
+    }
+
+    legacy::vec3 l_min(-1, -1, -1), l_max(1, 1, 1);
+    bench::run("scalar aabb slab test", count, [&]{
+        int hits = 0;
+        for (int i=0;i<count;i++) hits += legacy::slab_hit(l_min, l_max, l_origins[i], l_dirs[i], 0.001, infinity);
+        bench::do_not_optimize(hits);
+    });
+
+    aabb box(point3(-1, -1, -1), point3(1, 1, 1));
+    bench::run("simd aabb slab test", count, [&]{
+        int hits = 0;
+        for (int i=0;i<count;i++) hits += box.hit(ray(origins[i], dirs[i]), 0.001, infinity);
+        bench::do_not_optimize(hits);
+    });
+
+    return 0;
+}
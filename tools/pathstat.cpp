@@ -0,0 +1,207 @@
+// Summarizes a path capture written by the renderer (paths.rtpath).
+//
+//   pathstat paths.rtpath [--top n]
+//
+// Prints the path length distribution, how paths end, and the paths, pixels
+// and lights that carry the most radiance.
+
+#include "general.h"
+#include "path_capture.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+typedef path_capture_format::path_vertex path_vertex;
+
+struct path_summary {
+    uint32_t pixel;
+    uint16_t sample;
+    int length;             // rays traced
+    int end_event;          // last event before path_end
+    uint32_t light;         // material of the emit vertex, 0 if none
+    double luminance;
+    float radiance[3];
+};
+
+static int usage() {
+    std::cerr << "usage: pathstat paths.rtpath [--top n]\n";
+    return 1;
+}
+
+static double luminance(const float* c) {
+    return 0.2126*c[0] + 0.7152*c[1] + 0.0722*c[2];
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2)
+        return usage();
+    size_t top = 10;
+    for (int i=2;i<argc;i++){
+        std::string arg = argv[i];
+        if (arg == "--top" && i+1 < argc)
+            top = static_cast<size_t>(std::atoi(argv[++i]));
+        else
+            return usage();
+    }
+
+    auto f = std::fopen(argv[1], "rb");
+    if (!f) {
+        std::cerr << "ERROR: Could not open '" << argv[1] << "'.\n";
+        return 1;
+    }
+    path_capture_format::file_header header;
+    if (std::fread(&header, sizeof(header), 1, f) != 1
+        || std::memcmp(header.magic, path_capture_format::magic, sizeof(header.magic)) != 0) {
+        std::cerr << "ERROR: '" << argv[1] << "' is not a path capture.\n";
+        std::fclose(f);
+        return 1;
+    }
+
+    // Paths are contiguous, camera vertex first and path_end last
+    std::vector<path_summary> paths;
+    uint64_t event_counts[path_capture_format::event_count] = {};
+    uint64_t vertex_count = 0, broken = 0;
+
+    path_summary current;
+    bool in_path = false;
+    std::vector<path_vertex> chunk(1 << 16);
+    size_t n;
+    while ((n = std::fread(chunk.data(), sizeof(path_vertex), chunk.size(), f)) > 0) {
+        for (size_t i=0;i<n;i++){
+            const auto& v = chunk[i];
+            vertex_count++;
+            if (v.event < path_capture_format::event_count)
+                event_counts[v.event]++;
+
+            if (v.event == path_capture_format::camera) {
+                if (in_path)
+                    broken++;
+                current = path_summary();
+                current.pixel = v.pixel;
+                current.sample = v.sample;
+                current.end_event = path_capture_format::camera;
+                current.light = 0;
+                in_path = true;
+            } else if (!in_path) {
+                broken++;
+            } else if (v.event == path_capture_format::path_end) {
+                // Vertices between the camera and path_end, less the cut-off marker
+                current.length = v.depth - 1 - (current.end_event == path_capture_format::max_depth);
+                std::memcpy(current.radiance, v.throughput, sizeof(current.radiance));
+                current.luminance = luminance(v.throughput);
+                paths.push_back(current);
+                in_path = false;
+            } else {
+                current.end_event = v.event;
+                if (v.event == path_capture_format::emit)
+                    current.light = v.material;
+            }
+        }
+    }
+    std::fclose(f);
+    if (in_path)
+        broken++;
+
+    std::printf("%s: %dx%d image, %zu paths, %llu vertices",
+        argv[1], header.width, header.height, paths.size(), static_cast<unsigned long long>(vertex_count));
+    if (broken)
+        std::printf(", %llu incomplete paths", static_cast<unsigned long long>(broken));
+    std::printf("\n");
+    if (paths.empty())
+        return 0;
+
+    // Path lengths
+    std::map<int, uint64_t> lengths;
+    double mean_length = 0;
+    for (const auto& p : paths) {
+        lengths[p.length]++;
+        mean_length += p.length;
+    }
+    mean_length /= paths.size();
+    uint64_t most = 0;
+    for (const auto& l : lengths)
+        most = std::max(most, l.second);
+
+    std::printf("\nPath length (rays), mean %.2f:\n", mean_length);
+    for (const auto& l : lengths) {
+        int bar = static_cast<int>(50.0 * l.second / most + 0.5);
+        std::printf("  %4d %10llu %6.2f%%  %s\n", l.first, static_cast<unsigned long long>(l.second),
+            100.0 * l.second / paths.size(), std::string(bar, '#').c_str());
+    }
+
+    std::printf("\nPath ends:\n");
+    uint64_t ends[path_capture_format::event_count] = {};
+    for (const auto& p : paths)
+        ends[p.end_event]++;
+    for (int e=0;e<path_capture_format::event_count;e++)
+        if (ends[e])
+            std::printf("  %-10s %10llu %6.2f%%\n", path_capture_format::event_name(e),
+                static_cast<unsigned long long>(ends[e]), 100.0 * ends[e] / paths.size());
+
+    std::printf("\nVertices:\n");
+    for (int e=0;e<path_capture_format::event_count;e++)
+        if (event_counts[e])
+            std::printf("  %-10s %10llu\n", path_capture_format::event_name(e),
+                static_cast<unsigned long long>(event_counts[e]));
+
+    // Heavy contributors
+    double total = 0;
+    for (const auto& p : paths)
+        total += p.luminance;
+
+    std::sort(paths.begin(), paths.end(), [](const path_summary& a, const path_summary& b) {
+        return a.luminance > b.luminance;
+    });
+    double top_percent = 0;
+    size_t top_count = std::max<size_t>(1, paths.size() / 100);
+    for (size_t i=0;i<top_count;i++)
+        top_percent += paths[i].luminance;
+
+    std::printf("\nTotal luminance %.6g, mean %.6g per path; the top 1%% of paths carry %.2f%%\n",
+        total, total / paths.size(), total > 0 ? 100.0 * top_percent / total : 0.0);
+
+    std::printf("\nBrightest paths:\n  %6s %6s %6s %6s %-10s %12s %28s\n",
+        "x", "y", "sample", "length", "end", "luminance", "radiance");
+    for (size_t i=0;i<std::min(top, paths.size());i++){
+        const auto& p = paths[i];
+        std::printf("  %6u %6u %6u %6d %-10s %12.6g %9.4g %9.4g %9.4g\n",
+            p.pixel % header.width, p.pixel / header.width, p.sample, p.length,
+            path_capture_format::event_name(p.end_event), p.luminance,
+            p.radiance[0], p.radiance[1], p.radiance[2]);
+    }
+
+    // Pixels and lights by their share of the radiance
+    std::map<uint32_t, double> pixels, lights;
+    for (const auto& p : paths) {
+        pixels[p.pixel] += p.luminance;
+        if (p.light)
+            lights[p.light] += p.luminance;
+    }
+
+    auto print_shares = [&](const char* title, const char* key, const std::map<uint32_t, double>& shares, bool is_pixel) {
+        std::vector<std::pair<uint32_t, double>> sorted(shares.begin(), shares.end());
+        std::sort(sorted.begin(), sorted.end(), [](const std::pair<uint32_t, double>& a, const std::pair<uint32_t, double>& b) {
+            return a.second > b.second;
+        });
+        std::printf("\n%s:\n  %-14s %12s %8s\n", title, key, "luminance", "share");
+        for (size_t i=0;i<std::min(top, sorted.size());i++){
+            char name[32];
+            if (is_pixel)
+                std::snprintf(name, sizeof(name), "%u, %u", sorted[i].first % header.width, sorted[i].first / header.width);
+            else
+                std::snprintf(name, sizeof(name), "%u", sorted[i].first);
+            std::printf("  %-14s %12.6g %7.2f%%\n", name, sorted[i].second,
+                total > 0 ? 100.0 * sorted[i].second / total : 0.0);
+        }
+    };
+    print_shares("Brightest pixels", "x, y", pixels, true);
+    print_shares("Lights by contribution", "material id", lights, false);
+
+    return 0;
+}
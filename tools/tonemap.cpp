@@ -0,0 +1,57 @@
+// Converts a linear PFM render into a display image without re-rendering.
+//
+//   tonemap input.pfm output.png [--exposure stops] [--operator clamp|reinhard|aces]
+//
+// The output format follows the extension (.png, .ppm, .hdr or .pfm). Float
+// outputs keep the exposure scale but skip the curve.
+
+#include "general.h"
+#include "framebuffer.h"
+#include "tonemap.h"
+
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+static int usage() {
+    std::cerr << "usage: tonemap input.pfm output.(png|ppm|hdr|pfm) "
+                 "[--exposure stops] [--operator clamp|reinhard|aces]\n";
+    return 1;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 3)
+        return usage();
+
+    std::string input = argv[1], output = argv[2];
+    tonemap_settings settings;
+
+    for (int i=3;i<argc;i++){
+        std::string arg = argv[i];
+        if (arg == "--exposure" && i+1 < argc)
+            settings.exposure = std::atof(argv[++i]);
+        else if (arg == "--operator" && i+1 < argc) {
+            if (!parse_tonemap_operator(argv[++i], settings.op)) {
+                std::cerr << "ERROR: Unknown operator '" << argv[i] << "'.\n";
+                return 1;
+            }
+        }
+        else
+            return usage();
+    }
+
+    framebuffer image;
+    if (!image.load_pfm(input))
+        return 1;
+
+    // High dynamic range outputs only get the exposure
+    auto ext = output.substr(output.rfind('.') + 1);
+    bool hdr_output = ext == "hdr" || ext == "pfm";
+
+    auto scale = exp2(settings.exposure);
+    for (int y=0;y<image.height;y++)
+        for (int x=0;x<image.width;x++)
+            image.set(x, y, hdr_output ? scale*image.get(x, y) : tonemap(image.get(x, y), settings));
+
+    return image.save(output) ? 0 : 1;
+}
@@ -14,38 +14,46 @@ class aabb {
 
         bool hit (const ray& r, double t_min, double t_max) const;
 
+        // Like hit, but narrows [t_min, t_max] to the part of the ray inside the box
+        bool clip (const ray& r, double& t_min, double& t_max) const;
+
         point3 minimum, maximum;
 };
 
 inline bool aabb :: hit (const ray& r, double t_min, double t_max) const {
+    return clip(r, t_min, t_max);
+}
+
+inline bool aabb :: clip (const ray& r, double& t_min, double& t_max) const {
+    // All three slabs at once; the padding lane is ignored below
+    auto invD = f64x4(1.0) / r.direction().simd();
+    auto origin = r.origin().simd();
+    auto t0 = (minimum.simd() - origin) * invD;
+    auto t1 = (maximum.simd() - origin) * invD;
+
+    // A ray parallel to a slab with its origin on one of the planes gives
+    // 0*inf = NaN there. min/max would pass the NaN through as the other
+    // operand, so such a slab is left out instead, like the scalar test did.
+    alignas(32) double near[4], far[4];
+    vnan_select(t0, t1, f64x4(-infinity), vmin(t0, t1)).store(near);
+    vnan_select(t0, t1, f64x4(infinity), vmax(t0, t1)).store(far);
+
     for (int i=0;i<3;i++){
-        auto invD = 1.0f/r.direction()[i];
-        auto t0 = (minimum[i]-r.origin()[i]) * invD;
-        auto t1 = (maximum[i]-r.origin()[i]) * invD;
-
-        if (invD < 0.0f) {
-            std::swap(t0, t1);
-        }
-        t_min = t0 > t_min ? t0 : t_min;
-        t_max = t1 < t_max ? t1 : t_max;
-
-        if (t_max <= t_min)
-            return false; 
+        t_min = near[i] > t_min ? near[i] : t_min;
+        t_max = far[i] < t_max ? far[i] : t_max;
     }
-    return true;
+    return t_max > t_min;
 }
 
 // Returns the box surrounding two given boxes
 aabb surrounding_box(const aabb& box0, const aabb& box1){
-    point3 small(fmin(box0.min().x(), box1.min().x()),
-                 fmin(box0.min().y(), box1.min().y()),
-                 fmin(box0.min().z(), box1.min().z()));
-
-    point3 big(fmax(box0.max().x(), box1.max().x()),
-               fmax(box0.max().y(), box1.max().y()),
-               fmax(box0.max().z(), box1.max().z()));
+    return aabb(vmin(box0.minimum, box1.minimum), vmax(box0.maximum, box1.maximum));
+}
 
-    return aabb(small,big);
+// Linear blend between two boxes; s = 0 gives box0, s = 1 gives box1
+inline aabb lerp_box(const aabb& box0, const aabb& box1, double s){
+    return aabb(box0.minimum + s*(box1.minimum - box0.minimum),
+                box0.maximum + s*(box1.maximum - box0.maximum));
 }
 
 #endif
\ No newline at end of file
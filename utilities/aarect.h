@@ -19,6 +19,11 @@ class xy_rect : public hittable {
             return true;
         }
 
+        // Point on the rectangle with texture coordinates (u, v)
+        point3 surface_point(double u, double v) const {
+            return point3(x0 + u*(x1-x0), y0 + v*(y1-y0), k);
+        }
+
     public:
         shared_ptr<material> mat_ptr;
         double x0, x1, y0, y1, k;
@@ -42,6 +47,11 @@ class xz_rect : public hittable {
             return true;
         }
 
+        // Point on the rectangle with texture coordinates (u, v)
+        point3 surface_point(double u, double v) const {
+            return point3(x0 + u*(x1-x0), k, z0 + v*(z1-z0));
+        }
+
     public:
         shared_ptr<material> mat_ptr;
         double x0, x1, z0, z1, k;
@@ -64,12 +74,18 @@ class yz_rect : public hittable {
             return true;
         }
 
+        // Point on the rectangle with texture coordinates (u, v)
+        point3 surface_point(double u, double v) const {
+            return point3(k, y0 + u*(y1-y0), z0 + v*(z1-z0));
+        }
+
     public:
         shared_ptr<material> mat_ptr;
         double y0, y1, z0, z1, k;
 };
 
 bool xy_rect :: hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
+    RT_STAT_INC(xy_rect_tests);
     auto t = (k-r.origin().z()) / (r.direction().z());
 
     if (t < t_min || t_max < t)
@@ -86,15 +102,17 @@ bool xy_rect :: hit(const ray& r, double t_min, double t_max, hit_record& rec) c
     rec.v = (y-y0)/(y1-y0);
     rec.p = r.at(t);
     rec.t = t;
-    rec.mat_ptr = mat_ptr;
+    rec.mat_ptr = mat_ptr.get();
     auto outward_normal = vec3(0, 0, 1);
     rec.set_face_normal(r, outward_normal);
+    rec.set_footprint(r, fmin(x1-x0, y1-y0));
 
     return true;
 
 }
 
 bool xz_rect::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
+    RT_STAT_INC(xz_rect_tests);
     auto t = (k-r.origin().y()) / r.direction().y();
     if (t < t_min || t > t_max)
         return false;
@@ -107,12 +125,14 @@ bool xz_rect::hit(const ray& r, double t_min, double t_max, hit_record& rec) con
     rec.t = t;
     auto outward_normal = vec3(0, 1, 0);
     rec.set_face_normal(r, outward_normal);
-    rec.mat_ptr = mat_ptr;
+    rec.set_footprint(r, fmin(x1-x0, z1-z0));
+    rec.mat_ptr = mat_ptr.get();
     rec.p = r.at(t);
     return true;
 }
 
 bool yz_rect::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
+    RT_STAT_INC(yz_rect_tests);
     auto t = (k-r.origin().x()) / r.direction().x();
     if (t < t_min || t > t_max)
         return false;
@@ -125,7 +145,8 @@ bool yz_rect::hit(const ray& r, double t_min, double t_max, hit_record& rec) con
     rec.t = t;
     auto outward_normal = vec3(1, 0, 0);
     rec.set_face_normal(r, outward_normal);
-    rec.mat_ptr = mat_ptr;
+    rec.set_footprint(r, fmin(y1-y0, z1-z0));
+    rec.mat_ptr = mat_ptr.get();
     rec.p = r.at(t);
     return true;
 }
@@ -0,0 +1,154 @@
+#ifndef AOV_H
+#define AOV_H
+
+#include "general.h"
+
+#include "image_writer.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+// What the camera ray of one sample saw at its first hit
+struct aov_sample {
+    bool hit = false;
+    color albedo;           // attenuation of the first scatter (emission if it did not scatter)
+    vec3 normal;            // shading normal
+    double depth = 0;       // distance along the camera ray
+    uint32_t object = 0;    // hittable::id of the top-level object
+    uint32_t material = 0;  // material::id
+};
+
+// Auxiliary per-pixel buffers (arbitrary output variables) written next to the
+// beauty image for compositing and denoising. Each feature is its own plane so
+// the render loop only touches what it writes.
+class aov_buffers {
+    public:
+        aov_buffers(int w, int h) : width(w), height(h) {
+            size_t n = static_cast<size_t>(w)*h;
+            albedo.assign(3*n, 0.0f);
+            normal.assign(3*n, 0.0f);
+            depth.assign(n, 0.0f);
+            variance.assign(n, 0.0f);
+            object_id.assign(n, 0);
+            material_id.assign(n, 0);
+            sample_count.assign(n, 0);
+        }
+
+        static double luminance_of(const color& c) {
+            return 0.2126*c.x() + 0.7152*c.y() + 0.0722*c.z();
+        }
+
+        // Per-pixel accumulator, kept on the stack while the pixel renders
+        struct pixel {
+            color albedo = color(0, 0, 0);
+            vec3 normal = vec3(0, 0, 0);
+            double depth = 0;
+            double luminance = 0, luminance_sq = 0;
+            int hits = 0;
+            int samples = 0;
+            uint32_t object = 0;
+            uint32_t material = 0;
+
+            // radiance is the sample's estimate, for the variance
+            void add(const aov_sample& s, const color& radiance) {
+                samples++;
+                auto l = luminance_of(radiance);
+                luminance += l;
+                luminance_sq += l*l;
+                albedo += s.albedo;
+                if (!s.hit)
+                    return;
+                hits++;
+                normal += s.normal;
+                depth += s.depth;
+                // Ids come from the first sample that hit something
+                if (hits == 1) {
+                    object = s.object;
+                    material = s.material;
+                }
+            }
+        };
+
+        // Stores the averages of pixel index i (row-major, top row first)
+        void store(int i, const pixel& p) {
+            if (p.samples == 0)
+                return;
+            auto a = p.albedo / p.samples;
+            auto n = p.hits ? p.normal / p.hits : vec3(0, 0, 0);
+            for (int c=0;c<3;c++){
+                albedo[3*i + c] = static_cast<float>(a[c]);
+                normal[3*i + c] = static_cast<float>(n[c]);
+            }
+            depth[i] = p.hits ? static_cast<float>(p.depth / p.hits) : 0.0f;
+
+            // Variance of the pixel mean's luminance
+            if (p.samples > 1) {
+                auto mean = p.luminance / p.samples;
+                auto sample_var = (p.luminance_sq - p.samples*mean*mean) / (p.samples - 1);
+                variance[i] = static_cast<float>(fmax(sample_var, 0.0) / p.samples);
+            }
+            object_id[i] = p.object;
+            material_id[i] = p.material;
+            sample_count[i] = static_cast<uint32_t>(p.samples);
+        }
+
+        // Copies row y of every plane from other, which has the same size
+        void copy_row(const aov_buffers& other, int y) {
+            auto copy = [this, y](auto& to, const auto& from, int channels) {
+                size_t begin = static_cast<size_t>(y)*width*channels, end = begin + static_cast<size_t>(width)*channels;
+                std::copy(from.begin() + begin, from.begin() + end, to.begin() + begin);
+            };
+            copy(albedo, other.albedo, 3);
+            copy(normal, other.normal, 3);
+            copy(depth, other.depth, 1);
+            copy(variance, other.variance, 1);
+            copy(object_id, other.object_id, 1);
+            copy(material_id, other.material_id, 1);
+            copy(sample_count, other.sample_count, 1);
+        }
+
+        // Writes <prefix>albedo.pfm, normal, depth, variance, object_id,
+        // material_id and sample_count. Single-valued planes are repeated in
+        // all three channels.
+        bool save(const std::string& prefix) const {
+            bool ok = save_plane(prefix + "albedo.pfm", [this](size_t i, int c) { return albedo[3*i + c]; });
+            ok = save_plane(prefix + "normal.pfm", [this](size_t i, int c) { return normal[3*i + c]; }) && ok;
+            ok = save_plane(prefix + "depth.pfm", [this](size_t i, int) { return depth[i]; }) && ok;
+            ok = save_plane(prefix + "variance.pfm", [this](size_t i, int) { return variance[i]; }) && ok;
+            ok = save_plane(prefix + "object_id.pfm", [this](size_t i, int) { return static_cast<float>(object_id[i]); }) && ok;
+            ok = save_plane(prefix + "material_id.pfm", [this](size_t i, int) { return static_cast<float>(material_id[i]); }) && ok;
+            ok = save_plane(prefix + "sample_count.pfm", [this](size_t i, int) { return static_cast<float>(sample_count[i]); }) && ok;
+            return ok;
+        }
+
+    private:
+        bool save_plane(const std::string& path, const std::function<float(size_t, int)>& value) const {
+            pfm_writer writer;
+            if (!writer.open(path, width, height))
+                return false;
+            std::vector<float> row(static_cast<size_t>(width)*3);
+            for (int y=0;y<height;y++){
+                for (int x=0;x<width;x++)
+                    for (int c=0;c<3;c++)
+                        row[3*x + c] = value(static_cast<size_t>(y)*width + x, c);
+                if (!writer.write_row(row.data()))
+                    return false;
+            }
+            return writer.close();
+        }
+
+    public:
+        int width, height;
+        std::vector<float> albedo;          // rgb
+        std::vector<float> normal;          // xyz
+        std::vector<float> depth;
+        std::vector<float> variance;        // of the pixel's mean luminance
+        std::vector<uint32_t> object_id;
+        std::vector<uint32_t> material_id;
+        std::vector<uint32_t> sample_count;
+};
+
+#endif
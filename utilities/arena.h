@@ -0,0 +1,128 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <utility>
+#include <vector>
+
+// Bump allocator for scene objects. Objects made with make_scene_shared while
+// a scene_arena::scope is alive are packed, control block and all, into large
+// blocks in creation order, so a BVH built depth first sits in memory in the
+// order traversal visits it. Nothing is freed one object at a time: the blocks
+// go when the arena and every object made in it are gone.
+class scene_arena : public std::enable_shared_from_this<scene_arena> {
+    public:
+        static const size_t default_block_bytes = 1 << 20;
+        static const size_t block_alignment = 64;   // a cache line
+
+        static std::shared_ptr<scene_arena> create(size_t block_bytes = default_block_bytes) {
+            return std::shared_ptr<scene_arena>(new scene_arena(block_bytes));
+        }
+
+        ~scene_arena() {
+            for (const auto& b : blocks)
+                ::operator delete(b.first, std::align_val_t(block_alignment));
+        }
+
+        scene_arena(const scene_arena&) = delete;
+        scene_arena& operator=(const scene_arena&) = delete;
+
+        void* allocate(size_t bytes, size_t alignment) {
+            std::lock_guard<std::mutex> lock(m);
+            auto p = align_up(cursor, alignment);
+            if (!cursor || p + bytes > end) {
+                // Oversized requests get a block of their own
+                auto size = std::max(block_bytes, bytes + alignment);
+                auto block = static_cast<char*>(::operator new(size, std::align_val_t(block_alignment)));
+                blocks.emplace_back(block, size);
+                reserved += size;
+                cursor = reinterpret_cast<uintptr_t>(block);
+                end = cursor + size;
+                p = align_up(cursor, alignment);
+            }
+            cursor = p + bytes;
+            used += bytes;
+            objects++;
+            return reinterpret_cast<void*>(p);
+        }
+
+        size_t bytes_used() const { std::lock_guard<std::mutex> lock(m); return used; }
+        size_t bytes_reserved() const { std::lock_guard<std::mutex> lock(m); return reserved; }
+        size_t object_count() const { std::lock_guard<std::mutex> lock(m); return objects; }
+
+        // The arena make_scene_shared uses on this thread, or null for the heap
+        static scene_arena* current() { return current_slot(); }
+
+        // Makes an arena current on this thread for the scope's lifetime
+        class scope {
+            public:
+                explicit scope(const std::shared_ptr<scene_arena>& arena) : previous(current_slot()) {
+                    current_slot() = arena.get();
+                }
+                ~scope() { current_slot() = previous; }
+
+                scope(const scope&) = delete;
+                scope& operator=(const scope&) = delete;
+
+            private:
+                scene_arena* previous;
+        };
+
+    private:
+        explicit scene_arena(size_t _block_bytes) : block_bytes(_block_bytes) {}
+
+        static uintptr_t align_up(uintptr_t p, size_t alignment) {
+            return (p + alignment - 1) & ~static_cast<uintptr_t>(alignment - 1);
+        }
+
+        static scene_arena*& current_slot() {
+            thread_local scene_arena* arena = nullptr;
+            return arena;
+        }
+
+    private:
+        size_t block_bytes;
+        mutable std::mutex m;
+        std::vector<std::pair<char*, size_t>> blocks;
+        uintptr_t cursor = 0, end = 0;
+        size_t used = 0, reserved = 0, objects = 0;
+};
+
+// Allocator handing out arena memory. Each shared_ptr control block keeps a
+// copy, and with it the arena, alive.
+template <typename T>
+struct arena_allocator {
+    typedef T value_type;
+
+    explicit arena_allocator(std::shared_ptr<scene_arena> a) : arena(std::move(a)) {}
+    template <typename U>
+    arena_allocator(const arena_allocator<U>& other) : arena(other.arena) {}
+
+    T* allocate(size_t n) {
+        return static_cast<T*>(arena->allocate(n*sizeof(T), alignof(T)));
+    }
+    void deallocate(T*, size_t) {}     // freed with the arena
+
+    std::shared_ptr<scene_arena> arena;
+};
+
+template <typename T, typename U>
+inline bool operator==(const arena_allocator<T>& a, const arena_allocator<U>& b) { return a.arena == b.arena; }
+template <typename T, typename U>
+inline bool operator!=(const arena_allocator<T>& a, const arena_allocator<U>& b) { return a.arena != b.arena; }
+
+// make_shared for scene objects: from this thread's current arena if there is
+// one, else from the heap
+template <typename T, typename... Args>
+inline std::shared_ptr<T> make_scene_shared(Args&&... args) {
+    if (auto* arena = scene_arena::current())
+        return std::allocate_shared<T>(arena_allocator<T>(arena->shared_from_this()), std::forward<Args>(args)...);
+    return std::make_shared<T>(std::forward<Args>(args)...);
+}
+
+#endif
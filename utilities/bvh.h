@@ -7,6 +7,11 @@
 #include "hittable_list.h"
 
 #include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <vector>
 
 class bvh_node : public hittable {
 
@@ -23,6 +28,7 @@ class bvh_node : public hittable {
 
         virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override;
         virtual bool bounding_box(double time0, double time1, aabb& output_bounding_box) const override;
+        virtual bool motion_bounding_box(double time0, double time1, aabb& box_start, aabb& box_end) const override;
 
         // bool box_compare(const shared_ptr<hittable> a, const shared_ptr<hittable> b, int axis);
         // bool box_x_compare(const shared_ptr<hittable> a, const shared_ptr<hittable> b);
@@ -34,6 +40,15 @@ class bvh_node : public hittable {
         shared_ptr<hittable> right;
         aabb box;
 
+        // Bounds at shutter open and close. When something below this node moves,
+        // traversal interpolates between them using the ray time.
+        aabb box_start, box_end;
+        double time0, time1;
+        bool moving;
+
+        // Children are the source objects rather than nodes built here
+        bool leaf;
+
 };
 
 inline bool  box_compare(const shared_ptr<hittable> a, const shared_ptr<hittable> b, int axis){
@@ -60,8 +75,8 @@ inline bool box_z_compare(const shared_ptr<hittable> a, const shared_ptr<hittabl
 
 bvh_node::bvh_node(
     const std::vector<shared_ptr<hittable>>& src_objects,
-    size_t start, size_t end, double time0, double time1
-) {
+    size_t start, size_t end, double _time0, double _time1
+) : time0(_time0), time1(_time1) {
     auto objects = src_objects; // Create a modifiable array of the source scene objects
 
     int axis = random_int(0,2);
@@ -71,6 +86,8 @@ bvh_node::bvh_node(
 
     size_t object_span = end - start;
 
+    leaf = object_span <= 2;
+
     if (object_span == 1) {
         left = right = objects[start];
     } else if (object_span == 2) {
@@ -85,30 +102,49 @@ bvh_node::bvh_node(
         std::sort(objects.begin() + start, objects.begin() + end, comparator);
 
         auto mid = start + object_span/2;
-        left = make_shared<bvh_node>(objects, start, mid, time0, time1);
-        right = make_shared<bvh_node>(objects, mid, end, time0, time1);
+        left = make_scene_shared<bvh_node>(objects, start, mid, time0, time1);
+        right = make_scene_shared<bvh_node>(objects, mid, end, time0, time1);
     }
 
-    aabb box_left, box_right;
+    aabb left_start, left_end, right_start, right_end;
 
-    if (  !left->bounding_box (time0, time1, box_left)
-       || !right->bounding_box(time0, time1, box_right)
+    if (  !left->motion_bounding_box (time0, time1, left_start, left_end)
+       || !right->motion_bounding_box(time0, time1, right_start, right_end)
     )
         std::cerr << "No bounding box in bvh_node constructor.\n";
 
-    box = surrounding_box(box_left, box_right);
+    box_start = surrounding_box(left_start, right_start);
+    box_end = surrounding_box(left_end, right_end);
+    box = surrounding_box(box_start, box_end);
+
+    moving = false;
+    for (int i=0;i<3;i++){
+        if (box_start.min()[i] != box_end.min()[i] || box_start.max()[i] != box_end.max()[i])
+            moving = time1 > time0;
+    }
 }
 
 bool bvh_node :: hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
-    // Check if it hits the root node
-    if (!box.hit(r, t_min, t_max)) 
+    RT_STAT_INC(bvh_nodes_visited);
+    // Check if it hits the root node. For moving contents use the box at the ray's
+    // time; outside the build interval fall back to the union of both ends.
+    if (moving) {
+        auto s = (r.time() - time0) / (time1 - time0);
+        aabb b = (s >= 0 && s <= 1) ? lerp_box(box_start, box_end, s) : box;
+        if (!b.hit(r, t_min, t_max))
+            return false;
+    } else if (!box.hit(r, t_min, t_max)) 
         return false;
 
     // Check if left node is hit
     bool hit_left = left->hit(r, t_min, t_max, rec);
+    if (hit_left && leaf)
+        rec.object = left.get();
     
     // If left is hit we decrease t_max to that rec.t to get closest hit point
     bool hit_right = right->hit(r, t_min, hit_left ? rec.t : t_max, rec);
+    if (hit_right && leaf)
+        rec.object = right.get();
 
     return hit_left || hit_right;
 }
@@ -118,7 +154,323 @@ bool bvh_node :: bounding_box(double time0, double time1, aabb& output_bounding_
     return true;
 }
 
+bool bvh_node :: motion_bounding_box(double _time0, double _time1, aabb& _box_start, aabb& _box_end) const {
+    _box_start = box_start;
+    _box_end = box_end;
+    return true;
+}
+
+// BVH in a flat array of 32-byte nodes, for scenes where bvh_node's pointers
+// and double-precision boxes take more memory than the geometry. Each node
+// stores its box as a float corner and a power-of-two step per axis, and its
+// two child boxes as 8-bit offsets in those steps, rounded outwards so they
+// only ever grow. Traversal is iterative and decodes the child boxes on the
+// fly. Boxes cover the whole shutter interval; moving objects are not given
+// the time-interpolated boxes bvh_node uses.
+class compressed_bvh : public hittable {
+
+    public:
+        struct node {
+            float origin[3];        // box minimum, rounded down
+            int8_t exponent[3];     // step per axis is 2^exponent
+            uint8_t flags;          // bit 0: left child is a primitive, bit 1: right child is
+            uint8_t bounds[2][6];   // per child: min xyz, max xyz in steps from origin
+            uint32_t child;         // see left() and right()
+
+            // Children that are nodes follow their parent depth first, and the
+            // primitives of one node are adjacent, so one index covers both
+            uint32_t left(uint32_t self) const { return (flags & 1) ? child : self + 1; }
+            uint32_t right(uint32_t self) const {
+                if (flags & 2)
+                    return child + (flags & 1);
+                return (flags & 1) ? self + 1 : child;
+            }
+        };
+        static_assert(sizeof(node) == 32, "two nodes per cache line");
+
+        // Splits the same way as bvh_node and draws the same axes, so both give
+        // the same tree for the same seed
+        compressed_bvh(const hittable_list& list, double time0, double time1);
+
+        virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override;
+        virtual bool bounding_box(double time0, double time1, aabb& output_bounding_box) const override;
+
+    private:
+        uint32_t build(std::vector<shared_ptr<hittable>>& objects, size_t start, size_t end, aabb& node_box);
+        uint32_t add_primitive(const shared_ptr<hittable>& object, aabb& object_box);
+        static void quantize(node& n, const aabb& node_box, const aabb children[2]);
+
+        // 2^e from the exponent bits, cheaper than ldexp
+        static double power_of_two(int e) {
+            uint64_t bits = static_cast<uint64_t>(e + 1023) << 52;
+            double d;
+            std::memcpy(&d, &bits, sizeof(d));
+            return d;
+        }
+
+    public:
+        std::vector<node> nodes;
+        std::vector<shared_ptr<hittable>> primitives;
+        aabb box;
+        double time0, time1;
+};
+
+compressed_bvh :: compressed_bvh(const hittable_list& list, double _time0, double _time1)
+    : time0(_time0), time1(_time1) {
+    if (list.objects.empty())
+        return;
+    auto objects = list.objects;
+    nodes.reserve(objects.size());
+    primitives.reserve(objects.size() + 1);
+    build(objects, 0, objects.size(), box);
+}
+
+uint32_t compressed_bvh :: add_primitive(const shared_ptr<hittable>& object, aabb& object_box) {
+    if (!object->bounding_box(time0, time1, object_box))
+        std::cerr << "No bounding box in compressed_bvh constructor.\n";
+    primitives.push_back(object);
+    return static_cast<uint32_t>(primitives.size() - 1);
+}
+
+// Emits the node for objects[start, end) and its subtree, sorting the range in
+// place. A single object gets a node with the object on both sides, as in
+// bvh_node.
+uint32_t compressed_bvh :: build(std::vector<shared_ptr<hittable>>& objects, size_t start, size_t end, aabb& node_box) {
+    auto self = static_cast<uint32_t>(nodes.size());
+    nodes.emplace_back();
+
+    int axis = random_int(0,2);
+    auto comparator = (axis == 0) ? box_x_compare
+                    : (axis == 1) ? box_y_compare
+                                  : box_z_compare;
+
+    size_t object_span = end - start;
+    aabb children[2];
+    uint8_t flags = 0;
+    uint32_t child = 0;
+
+    if (object_span <= 2) {
+        size_t first = start, second = object_span == 1 ? start : start+1;
+        if (object_span == 2 && !comparator(objects[first], objects[second]))
+            std::swap(first, second);
+        child = add_primitive(objects[first], children[0]);
+        add_primitive(objects[second], children[1]);
+        flags = 3;
+    } else {
+        std::sort(objects.begin() + start, objects.begin() + end, comparator);
+        auto mid = start + object_span/2;
+
+        // A one-object half is a primitive here where bvh_node makes a node,
+        // but it still draws that node's axis
+        if (mid - start == 1) {
+            random_int(0,2);
+            child = add_primitive(objects[start], children[0]);
+            flags |= 1;
+        } else {
+            build(objects, start, mid, children[0]);
+        }
+        if (end - mid == 1) {
+            random_int(0,2);
+            auto index = add_primitive(objects[mid], children[1]);
+            if (!(flags & 1))
+                child = index;
+            flags |= 2;
+        } else {
+            auto index = build(objects, mid, end, children[1]);
+            if (!(flags & 1))
+                child = index;
+        }
+    }
+
+    node_box = surrounding_box(children[0], children[1]);
+    auto& n = nodes[self];
+    n.flags = flags;
+    n.child = child;
+    quantize(n, node_box, children);
+    return self;
+}
+
+void compressed_bvh :: quantize(node& n, const aabb& node_box, const aabb children[2]) {
+    for (int a=0;a<3;a++){
+        // Round the origin down so the grid starts at or below the box
+        double lo = node_box.min()[a];
+        float origin = static_cast<float>(lo);
+        if (origin > lo)
+            origin = std::nextafter(origin, -std::numeric_limits<float>::infinity());
+
+        // Smallest power-of-two step that spans the box in 255 steps
+        double extent = node_box.max()[a] - origin;
+        int e;
+        std::frexp(extent / 255, &e);
+        while (std::ldexp(255.0, e) < extent)
+            e++;
+        e = std::max(-127, std::min(127, e));
+        double step = std::ldexp(1.0, e);
+
+        n.origin[a] = origin;
+        n.exponent[a] = static_cast<int8_t>(e);
+        for (int c=0;c<2;c++){
+            double q0 = std::floor((children[c].min()[a] - origin) / step);
+            double q1 = std::ceil((children[c].max()[a] - origin) / step);
+            n.bounds[c][a] = static_cast<uint8_t>(std::max(0.0, std::min(255.0, q0)));
+            n.bounds[c][3 + a] = static_cast<uint8_t>(std::max(0.0, std::min(255.0, q1)));
+        }
+    }
+}
+
+bool compressed_bvh :: hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
+    if (nodes.empty())
+        return false;
+
+    auto invD = f64x4(1.0) / r.direction().simd();
+    auto ray_origin = r.origin().simd();
+
+    // Nodes still to visit, with the distance at which the ray enters them.
+    // The tree is balanced, so its depth stays far below the stack size.
+    struct entry { uint32_t index; double t; };
+    entry stack[64];
+    int stack_size = 0;
+
+    bool hit_anything = false;
+    double closest = t_max;
+    uint32_t index = 0;
+
+    while (true) {
+        RT_STAT_INC(bvh_nodes_visited);
+        const node& n = nodes[index];
+
+        // Slab distances are linear in the quantized bounds: t = base + q*per_step.
+        // Where the direction has a zero component this can give NaN; such a
+        // slab is left out, so the box only gets looser.
+        auto origin = f64x4(n.origin[0], n.origin[1], n.origin[2], 0);
+        auto step = f64x4(power_of_two(n.exponent[0]), power_of_two(n.exponent[1]), power_of_two(n.exponent[2]), 0);
+        auto base = (origin - ray_origin) * invD;
+        auto per_step = step * invD;
+
+        // Entry distance into each child box, or infinity on a miss
+        double t_enter[2];
+        for (int c=0;c<2;c++){
+            const uint8_t* q = n.bounds[c];
+            auto t0 = base + f64x4(q[0], q[1], q[2], 0) * per_step;
+            auto t1 = base + f64x4(q[3], q[4], q[5], 0) * per_step;
+
+            alignas(32) double near[4], far[4];
+            vnan_select(t0, t1, f64x4(-infinity), vmin(t0, t1)).store(near);
+            vnan_select(t0, t1, f64x4(infinity), vmax(t0, t1)).store(far);
+
+            double lo = t_min, hi = closest;
+            for (int i=0;i<3;i++){
+                lo = near[i] > lo ? near[i] : lo;
+                hi = far[i] < hi ? far[i] : hi;
+            }
+            t_enter[c] = hi > lo ? lo : infinity;
+        }
+
+        // Primitives first, so their hits cull the child nodes
+        uint32_t child_index[2] = {n.left(index), n.right(index)};
+        for (int c=0;c<2;c++){
+            if (!(n.flags & (1 << c)) || t_enter[c] >= closest)
+                continue;
+            const hittable* object = primitives[child_index[c]].get();
+            if (object->hit(r, t_min, closest, rec)) {
+                hit_anything = true;
+                closest = rec.t;
+                rec.object = object;
+            }
+            t_enter[c] = infinity;
+        }
+
+        bool visit_left = !(n.flags & 1) && t_enter[0] < closest;
+        bool visit_right = !(n.flags & 2) && t_enter[1] < closest;
+
+        if (visit_left && visit_right) {
+            // Nearer child next, the other one later
+            int nearer = t_enter[1] < t_enter[0];
+            stack[stack_size++] = {child_index[1 - nearer], t_enter[1 - nearer]};
+            index = child_index[nearer];
+            continue;
+        }
+        if (visit_left || visit_right) {
+            index = child_index[visit_left ? 0 : 1];
+            continue;
+        }
+
+        // Pop the next node the ray can still reach before the closest hit
+        while (stack_size > 0 && stack[stack_size - 1].t >= closest)
+            stack_size--;
+        if (stack_size == 0)
+            break;
+        index = stack[--stack_size].index;
+    }
+
+    return hit_anything;
+}
+
+bool compressed_bvh :: bounding_box(double time0, double time1, aabb& output_bounding_box) const {
+    output_bounding_box = box;
+    return !nodes.empty();
+}
+
+// Acceleration structure over a scene's top-level objects. Everything with a
+// bounding box goes into one BVH; objects without bounds are kept on a separate
+// list and tested linearly after it. Nested hittable_lists are flattened first.
+// The top-level objects are numbered in scene order for the object_id AOV.
+class scene_bvh : public hittable {
+
+    public:
+        // compressed builds a compressed_bvh instead of bvh_nodes
+        scene_bvh(const hittable_list& world, double time0, double time1, bool compressed = false);
+
+        virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override;
+        virtual bool bounding_box(double time0, double time1, aabb& output_bounding_box) const override;
 
+    private:
+        void collect(const hittable_list& list, double time0, double time1, hittable_list& bounded);
 
+    public:
+        shared_ptr<hittable> bounded;
+        hittable_list unbounded;
+};
+
+scene_bvh :: scene_bvh(const hittable_list& world, double time0, double time1, bool compressed) {
+    hittable_list bounded_objects;
+    collect(world, time0, time1, bounded_objects);
+
+    if (bounded_objects.objects.empty())
+        return;
+    if (compressed)
+        bounded = make_scene_shared<compressed_bvh>(bounded_objects, time0, time1);
+    else
+        bounded = make_scene_shared<bvh_node>(bounded_objects, time0, time1);
+}
+
+void scene_bvh :: collect(const hittable_list& list, double time0, double time1, hittable_list& bounded_objects) {
+    aabb temp_box;
+    for (const auto& object : list.objects) {
+        auto nested = std::dynamic_pointer_cast<hittable_list>(object);
+        if (nested) {
+            collect(*nested, time0, time1, bounded_objects);
+            continue;
+        }
+        object->id = static_cast<uint32_t>(bounded_objects.objects.size() + unbounded.objects.size() + 1);
+        if (object->bounding_box(time0, time1, temp_box))
+            bounded_objects.add(object);
+        else
+            unbounded.add(object);
+    }
+}
+
+bool scene_bvh :: hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
+    bool hit_bounded = bounded && bounded->hit(r, t_min, t_max, rec);
+    bool hit_unbounded = !unbounded.objects.empty() && unbounded.hit(r, t_min, hit_bounded ? rec.t : t_max, rec);
+
+    return hit_bounded || hit_unbounded;
+}
+
+bool scene_bvh :: bounding_box(double time0, double time1, aabb& output_bounding_box) const {
+    if (!bounded || !unbounded.objects.empty())
+        return false;
+    return bounded->bounding_box(time0, time1, output_bounding_box);
+}
 
-#endif
\ No newline at end of file
+#endif
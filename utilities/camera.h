@@ -36,6 +36,12 @@ class camera{
             lens_radius = aperture / 2;
             time0 = _time0;
             time1 = _time1;
+            viewport_angle = viewport_height;
+        }
+
+        // Rays from get_ray become cones spanning one pixel of an image this tall
+        void set_resolution(int image_height) {
+            pixel_spread = viewport_angle / image_height;
         }
 
         ray get_ray(double s, double t) const {
@@ -44,7 +50,9 @@ class camera{
             return ray(
                     origin + offset,
                     lower_left_corner + s*horizontal + t*vertical - origin - offset,
-                    random_double(time0, time1)
+                    random_double(time0, time1),
+                    0.0,
+                    pixel_spread
             );
         }
 
@@ -57,6 +65,8 @@ class camera{
         double lens_radius;
         double time0;   // Shutter open and close times 
         double time1;
+        double viewport_angle;      // Viewport height at unit distance
+        double pixel_spread = 0;    // Cone spread of primary rays
 };
 
 #endif
\ No newline at end of file
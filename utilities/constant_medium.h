@@ -11,11 +11,11 @@ class constant_medium : public hittable {
     public:
         constant_medium(
             shared_ptr<hittable> b, double d, shared_ptr<texture> t
-        ) : boundary(b), phase_function(make_shared<isotropic>(t)), neg_inv_density(-1/d){}
+        ) : boundary(b), phase_function(make_scene_shared<isotropic>(t)), neg_inv_density(-1/d){}
 
         constant_medium(
             shared_ptr<hittable> b, double d, color c
-        ) : boundary(b), phase_function(make_shared<isotropic>(c)), neg_inv_density(-1/d){}
+        ) : boundary(b), phase_function(make_scene_shared<isotropic>(c)), neg_inv_density(-1/d){}
 
         virtual bool hit(
             const ray& r, double t_min, double t_max, hit_record& rec
@@ -32,6 +32,7 @@ class constant_medium : public hittable {
 };
 
 bool constant_medium :: hit(const ray& r, double t_min, double t_max, hit_record& rec) const{
+    RT_STAT_INC(constant_medium_tests);
     
     const bool enableDebug = false;
     const bool debugging = enableDebug && random_double() < 0.0001;
@@ -61,6 +62,7 @@ bool constant_medium :: hit(const ray& r, double t_min, double t_max, hit_record
     if (hit_distance > distance_inside_boundary)
         return false;
 
+    RT_STAT_INC(constant_medium_scatters);
     rec.t = rec1.t + hit_distance/ray_length;
     rec.p = r.at(rec.t);
 
@@ -72,7 +74,8 @@ bool constant_medium :: hit(const ray& r, double t_min, double t_max, hit_record
 
     rec.normal = vec3(1,0,0);  // arbitrary
     rec.front_face = true;     // also arbitrary
-    rec.mat_ptr = phase_function;
+    rec.footprint = 0;
+    rec.mat_ptr = phase_function.get();
 
     return true;
 }
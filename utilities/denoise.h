@@ -0,0 +1,261 @@
+#ifndef DENOISE_H
+#define DENOISE_H
+
+#include "general.h"
+
+#include "aov.h"
+#include "framebuffer.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <future>
+#include <vector>
+
+struct denoise_settings {
+    int iterations = 5;             // filter radius doubles with each one
+    float sigma_luminance = 4.0f;   // luminance edge stop, in standard deviations
+    float sigma_normal = 64.0f;     // normal edge stop, on 1 - cos
+    float sigma_depth = 0.05f;      // depth edge stop, relative to the depth
+    unsigned thread_count = 0;
+};
+
+// Edge-avoiding a-trous wavelet filter guided by the feature buffers. The
+// albedo is divided out first so texture detail is not blurred, and the
+// luminance edge stop scales with the per-pixel standard deviation, which is
+// filtered alongside the color. Works on partial renders too: pixels without
+// samples take no part as neighbours.
+class atrous_denoiser {
+    public:
+        atrous_denoiser(const aov_buffers& aovs, const denoise_settings& _settings = denoise_settings());
+
+        framebuffer run(const framebuffer& beauty) const;
+
+        // exp(-x) for x >= 0 to about 1e-5 relative error. Branch-free, unlike
+        // std::exp, so the tap loop vectorizes: 2^t is split into 2^round(t),
+        // built in the exponent bits, times a polynomial on [-0.5, 0.5].
+        static float exp_neg(float x) {
+            float t = (x < 80.0f ? x : 80.0f) * -1.44269504f;
+            float whole = (t + 12582912.0f) - 12582912.0f;    // round to nearest
+            float f = t - whole;
+            float p = 1.0f + f*(0.69314718f + f*(0.24022651f + f*(0.05550411f + f*(0.00961813f + f*0.00133336f))));
+            int32_t bits = (static_cast<int32_t>(whole) + 127) << 23;
+            float scale;
+            std::memcpy(&scale, &bits, sizeof(scale));
+            return p * scale;
+        }
+
+    private:
+        // One pass with taps 2^level pixels apart, reading src and writing dst
+        void pass(int level, const std::vector<float>* src, std::vector<float>* dst, int y0, int y1) const;
+
+        void add_tap(
+            float k, size_t row, size_t nrow, int offset, int x0, int x1, const std::vector<float>* src,
+            float* __restrict sum_w, float* __restrict sum_r, float* __restrict sum_g, float* __restrict sum_b, float* __restrict sum_v
+        ) const;
+        void add_center(
+            float k, size_t row, const std::vector<float>* src,
+            float* __restrict sum_w, float* __restrict sum_r, float* __restrict sum_g, float* __restrict sum_b, float* __restrict sum_v
+        ) const;
+
+    private:
+        denoise_settings settings;
+        int width, height;
+
+        // Guides, one plane per component
+        std::vector<float> nx, ny, nz;
+        std::vector<float> depth, variance;
+        std::vector<float> inv_depth;       // 1 / depth edge-stop scale
+        std::vector<float> valid;           // 1 if the pixel has samples
+        std::vector<float> demodulate[3];   // albedo, or 1 where it is ~0
+
+        mutable std::vector<float> luminance;       // of the pass input
+        mutable std::vector<float> inv_luminance;   // 1 / luminance edge-stop scale
+};
+
+atrous_denoiser :: atrous_denoiser(const aov_buffers& aovs, const denoise_settings& _settings)
+    : settings(_settings), width(aovs.width), height(aovs.height)
+{
+    size_t n = static_cast<size_t>(width)*height;
+    nx.resize(n); ny.resize(n); nz.resize(n);
+    inv_depth.resize(n);
+    valid.resize(n);
+    depth = aovs.depth;
+    variance = aovs.variance;
+    luminance.resize(n);
+    inv_luminance.resize(n);
+    for (auto& d : demodulate)
+        d.resize(n);
+
+    for (size_t i=0;i<n;i++){
+        nx[i] = aovs.normal[3*i];
+        ny[i] = aovs.normal[3*i + 1];
+        nz[i] = aovs.normal[3*i + 2];
+        inv_depth[i] = 1.0f / (settings.sigma_depth * aovs.depth[i] + 1e-3f);
+        valid[i] = aovs.sample_count[i] > 0 ? 1.0f : 0.0f;
+        for (int c=0;c<3;c++){
+            auto a = aovs.albedo[3*i + c];
+            demodulate[c][i] = a > 1e-3f ? a : 1.0f;
+        }
+    }
+}
+
+// Accumulates, for pixels x0..x1 of the row starting at index row, the tap at
+// x + offset of the row starting at nrow. Plain pointers keep the loop free of
+// aliasing and bounds checks, so it vectorizes; they stay at row starts, so
+// none points outside its plane.
+void atrous_denoiser :: add_tap(
+    float k, size_t row, size_t nrow, int offset, int x0, int x1, const std::vector<float>* src,
+    float* __restrict sum_w, float* __restrict sum_r, float* __restrict sum_g, float* __restrict sum_b, float* __restrict sum_v
+) const {
+    const float* __restrict li = luminance.data() + row;
+    const float* __restrict lj = luminance.data() + nrow;
+    const float* __restrict inv_l = inv_luminance.data() + row;
+    const float* __restrict di = depth.data() + row;
+    const float* __restrict dj = depth.data() + nrow;
+    const float* __restrict inv_d = inv_depth.data() + row;
+    const float* __restrict nxi = nx.data() + row;
+    const float* __restrict nyi = ny.data() + row;
+    const float* __restrict nzi = nz.data() + row;
+    const float* __restrict nxj = nx.data() + nrow;
+    const float* __restrict nyj = ny.data() + nrow;
+    const float* __restrict nzj = nz.data() + nrow;
+    const float* __restrict valid_j = valid.data() + nrow;
+    const float* __restrict r = src[0].data() + nrow;
+    const float* __restrict g = src[1].data() + nrow;
+    const float* __restrict b = src[2].data() + nrow;
+    const float* __restrict v = src[3].data() + nrow;
+    const float sigma_n = settings.sigma_normal;
+
+    for (int x=x0;x<x1;x++){
+        const float cos_n = nxi[x]*nxj[x + offset] + nyi[x]*nyj[x + offset] + nzi[x]*nzj[x + offset];
+
+        // All three edge stops in one exponential
+        const float e = std::abs(li[x] - lj[x + offset]) * inv_l[x]
+                      + std::abs(di[x] - dj[x + offset]) * inv_d[x]
+                      + sigma_n * (1.0f - cos_n);
+        const float w = k * valid_j[x + offset] * exp_neg(e);
+
+        sum_w[x] += w;
+        sum_r[x] += w * r[x + offset];
+        sum_g[x] += w * g[x + offset];
+        sum_b[x] += w * b[x + offset];
+        sum_v[x] += w * w * v[x + offset];
+    }
+}
+
+void atrous_denoiser :: add_center(
+    float k, size_t row, const std::vector<float>* src,
+    float* __restrict sum_w, float* __restrict sum_r, float* __restrict sum_g, float* __restrict sum_b, float* __restrict sum_v
+) const {
+    const float* __restrict r = src[0].data() + row;
+    const float* __restrict g = src[1].data() + row;
+    const float* __restrict b = src[2].data() + row;
+    const float* __restrict v = src[3].data() + row;
+    for (int x=0;x<width;x++){
+        sum_w[x] += k;
+        sum_r[x] += k * r[x];
+        sum_g[x] += k * g[x];
+        sum_b[x] += k * b[x];
+        sum_v[x] += k * k * v[x];
+    }
+}
+
+// Planes: r, g, b, variance
+void atrous_denoiser :: pass(int level, const std::vector<float>* src, std::vector<float>* dst, int y0, int y1) const {
+    static const float h[3] = {3.0f/8, 1.0f/4, 1.0f/16};
+    const int step = 1 << level;
+
+    std::vector<float> sum_w(width), sum_r(width), sum_g(width), sum_b(width), sum_v(width);
+
+    for (int y=y0;y<y1;y++){
+        std::fill(sum_w.begin(), sum_w.end(), 0.0f);
+        std::fill(sum_r.begin(), sum_r.end(), 0.0f);
+        std::fill(sum_g.begin(), sum_g.end(), 0.0f);
+        std::fill(sum_b.begin(), sum_b.end(), 0.0f);
+        std::fill(sum_v.begin(), sum_v.end(), 0.0f);
+
+        const size_t row = static_cast<size_t>(y)*width;
+
+        // Taps in the outer loops, so the inner loop runs along contiguous rows
+        for (int dy=-2;dy<=2;dy++){
+            int yy = y + dy*step;
+            if (yy < 0 || yy >= height)
+                continue;
+            for (int dx=-2;dx<=2;dx++){
+                const float k = h[std::abs(dx)] * h[std::abs(dy)];
+                const int offset = dx*step;
+                const int x0 = std::max(0, -offset), x1 = std::min(width, width - offset);
+                const size_t nrow = static_cast<size_t>(yy)*width;
+
+                // The center pixel always has full weight
+                if (dx == 0 && dy == 0) {
+                    add_center(k, row, src, sum_w.data(), sum_r.data(), sum_g.data(), sum_b.data(), sum_v.data());
+                    continue;
+                }
+                add_tap(k, row, nrow, offset, x0, x1, src, sum_w.data(), sum_r.data(), sum_g.data(), sum_b.data(), sum_v.data());
+            }
+        }
+
+        for (int x=0;x<width;x++){
+            const float inv = 1.0f / sum_w[x];
+            dst[0][row + x] = sum_r[x] * inv;
+            dst[1][row + x] = sum_g[x] * inv;
+            dst[2][row + x] = sum_b[x] * inv;
+            dst[3][row + x] = sum_v[x] * inv * inv;
+        }
+    }
+}
+
+framebuffer atrous_denoiser :: run(const framebuffer& beauty) const {
+    const size_t n = static_cast<size_t>(width)*height;
+    std::vector<float> a[4], b[4];
+    for (int c=0;c<4;c++){
+        a[c].resize(n);
+        b[c].resize(n);
+    }
+
+    // Filter irradiance (color over albedo), with its variance
+    for (size_t i=0;i<n;i++){
+        for (int c=0;c<3;c++)
+            a[c][i] = beauty.pixels[3*i + c] / demodulate[c][i];
+        auto l = 0.2126f*demodulate[0][i] + 0.7152f*demodulate[1][i] + 0.0722f*demodulate[2][i];
+        a[3][i] = variance[i] / std::max(l*l, 1e-6f);
+    }
+
+    thread_pool pool(settings.thread_count);
+    const int band = std::max(1, height / static_cast<int>(4*pool.size()));
+    auto* src = a;
+    auto* dst = b;
+
+    for (int level=0;level<settings.iterations;level++){
+        for (size_t i=0;i<n;i++){
+            luminance[i] = 0.2126f*src[0][i] + 0.7152f*src[1][i] + 0.0722f*src[2][i];
+            inv_luminance[i] = 1.0f / (settings.sigma_luminance * std::sqrt(std::max(src[3][i], 0.0f)) + 1e-4f);
+        }
+
+        std::vector<std::future<void>> bands;
+        for (int y=0;y<height;y+=band){
+            int y1 = std::min(y + band, height);
+            bands.push_back(pool.submit([this, level, src, dst, y, y1]{ pass(level, src, dst, y, y1); }));
+        }
+        for (auto& f : bands)
+            f.get();
+        std::swap(src, dst);
+    }
+
+    framebuffer out(width, height);
+    for (size_t i=0;i<n;i++)
+        for (int c=0;c<3;c++)
+            out.pixels[3*i + c] = src[c][i] * demodulate[c][i];
+    return out;
+}
+
+inline framebuffer denoise(
+    const framebuffer& beauty, const aov_buffers& aovs, const denoise_settings& settings = denoise_settings()
+) {
+    return atrous_denoiser(aovs, settings).run(beauty);
+}
+
+#endif
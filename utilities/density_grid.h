@@ -0,0 +1,120 @@
+#ifndef DENSITY_GRID_H
+#define DENSITY_GRID_H
+
+#include "general.h"
+#include "aabb.h"
+
+#include <algorithm>
+#include <functional>
+#include <vector>
+
+// Spatially varying density for heterogeneous media
+class density_field {
+    public:
+        virtual ~density_field() {}
+
+        virtual double density(const point3& p) const = 0;
+
+        // Upper bound of density() anywhere inside region
+        virtual double max_density(const aabb& region) const = 0;
+
+        // Region outside of which the density is zero
+        virtual aabb bounds() const = 0;
+};
+
+// Dense voxel grid with cell-centered samples and trilinear interpolation
+class dense_grid : public density_field {
+    public:
+        dense_grid(const aabb& _bounds, int _nx, int _ny, int _nz)
+            : box(_bounds), nx(_nx), ny(_ny), nz(_nz), values(static_cast<size_t>(_nx)*_ny*_nz, 0.0f) {
+            auto extent = box.max() - box.min();
+            cell_size = vec3(extent.x()/nx, extent.y()/ny, extent.z()/nz);
+            inv_cell_size = vec3(1/cell_size.x(), 1/cell_size.y(), 1/cell_size.z());
+        }
+
+        // Fills the grid by evaluating f at every voxel center
+        static shared_ptr<dense_grid> from_function(
+            const aabb& bounds, int nx, int ny, int nz, const std::function<double(const point3&)>& f
+        ) {
+            auto grid = make_scene_shared<dense_grid>(bounds, nx, ny, nz);
+            for (int k=0;k<nz;k++)
+                for (int j=0;j<ny;j++)
+                    for (int i=0;i<nx;i++)
+                        grid->at(i, j, k) = static_cast<float>(f(grid->voxel_center(i, j, k)));
+            return grid;
+        }
+
+        float& at(int i, int j, int k) { return values[index(i, j, k)]; }
+        float at(int i, int j, int k) const { return values[index(i, j, k)]; }
+
+        point3 voxel_center(int i, int j, int k) const {
+            return box.min() + vec3((i+0.5)*cell_size.x(), (j+0.5)*cell_size.y(), (k+0.5)*cell_size.z());
+        }
+
+        virtual double density(const point3& p) const override {
+            // Continuous voxel coordinates relative to the voxel centers
+            auto g = (p - box.min()) * inv_cell_size - vec3(0.5, 0.5, 0.5);
+
+            auto fx = floor(g.x()), fy = floor(g.y()), fz = floor(g.z());
+            auto tx = g.x()-fx, ty = g.y()-fy, tz = g.z()-fz;
+            int i = static_cast<int>(fx), j = static_cast<int>(fy), k = static_cast<int>(fz);
+
+            auto c000 = fetch(i, j, k),     c100 = fetch(i+1, j, k);
+            auto c010 = fetch(i, j+1, k),   c110 = fetch(i+1, j+1, k);
+            auto c001 = fetch(i, j, k+1),   c101 = fetch(i+1, j, k+1);
+            auto c011 = fetch(i, j+1, k+1), c111 = fetch(i+1, j+1, k+1);
+
+            auto c00 = c000 + tx*(c100-c000), c10 = c010 + tx*(c110-c010);
+            auto c01 = c001 + tx*(c101-c001), c11 = c011 + tx*(c111-c011);
+            auto c0 = c00 + ty*(c10-c00), c1 = c01 + ty*(c11-c01);
+            return c0 + tz*(c1-c0);
+        }
+
+        virtual double max_density(const aabb& region) const override {
+            // Every voxel whose center can contribute to a point in region
+            int i0, j0, k0, i1, j1, k1;
+            voxel_range(region.min(), i0, j0, k0);
+            voxel_range(region.max(), i1, j1, k1);
+            i1++; j1++; k1++;
+
+            i0 = std::max(i0, 0); j0 = std::max(j0, 0); k0 = std::max(k0, 0);
+            i1 = std::min(i1, nx-1); j1 = std::min(j1, ny-1); k1 = std::min(k1, nz-1);
+
+            float m = 0;
+            for (int k=k0;k<=k1;k++)
+                for (int j=j0;j<=j1;j++)
+                    for (int i=i0;i<=i1;i++)
+                        m = std::max(m, at(i, j, k));
+            return m;
+        }
+
+        virtual aabb bounds() const override { return box; }
+
+    private:
+        size_t index(int i, int j, int k) const {
+            return (static_cast<size_t>(k)*ny + j)*nx + i;
+        }
+
+        // Zero outside the grid
+        float fetch(int i, int j, int k) const {
+            if (i < 0 || j < 0 || k < 0 || i >= nx || j >= ny || k >= nz)
+                return 0;
+            return values[index(i, j, k)];
+        }
+
+        void voxel_range(const point3& p, int& i, int& j, int& k) const {
+            auto g = (p - box.min()) * inv_cell_size - vec3(0.5, 0.5, 0.5);
+            i = static_cast<int>(floor(clamp(g.x(), -1, nx)));
+            j = static_cast<int>(floor(clamp(g.y(), -1, ny)));
+            k = static_cast<int>(floor(clamp(g.z(), -1, nz)));
+        }
+
+    public:
+        aabb box;
+        int nx, ny, nz;
+        vec3 cell_size;
+        vec3 inv_cell_size;
+        std::vector<float> values;
+};
+
+#endif
@@ -0,0 +1,99 @@
+#ifndef FRAMEBUFFER_H
+#define FRAMEBUFFER_H
+
+#include "general.h"
+
+#include "image_writer.h"
+
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Linear float RGB image, rows top first. Holds unclamped radiance so exposure
+// and tonemapping can be decided after rendering.
+class framebuffer {
+    public:
+        framebuffer() {}
+        framebuffer(int w, int h) : width(w), height(h), pixels(static_cast<size_t>(w)*h*3, 0.0f) {}
+
+        float* row(int y) { return &pixels[static_cast<size_t>(y)*width*3]; }
+        const float* row(int y) const { return &pixels[static_cast<size_t>(y)*width*3]; }
+
+        color get(int x, int y) const {
+            auto p = row(y) + 3*x;
+            return color(p[0], p[1], p[2]);
+        }
+
+        void set(int x, int y, const color& c) {
+            auto p = row(y) + 3*x;
+            p[0] = static_cast<float>(c.x());
+            p[1] = static_cast<float>(c.y());
+            p[2] = static_cast<float>(c.z());
+        }
+
+        // Reads a PFM file (color or greyscale, either byte order)
+        bool load_pfm(const std::string& path);
+
+        // Writes in the format given by the file extension
+        bool save(const std::string& path) const {
+            auto writer = make_image_writer(path);
+            if (!writer || !writer->open(path, width, height))
+                return false;
+            for (int y=0;y<height;y++)
+                if (!writer->write_row(row(y)))
+                    return false;
+            return writer->close();
+        }
+
+    public:
+        int width = 0, height = 0;
+        std::vector<float> pixels;
+};
+
+bool framebuffer :: load_pfm(const std::string& path) {
+    auto f = std::fopen(path.c_str(), "rb");
+    if (!f) {
+        std::cerr << "ERROR: Could not open '" << path << "'.\n";
+        return false;
+    }
+
+    char type[3] = {0, 0, 0};
+    int w = 0, h = 0;
+    double scale = 0;
+    bool ok = std::fscanf(f, "%2s %d %d %lf", type, &w, &h, &scale) == 4
+        && type[0] == 'P' && (type[1] == 'F' || type[1] == 'f') && w > 0 && h > 0
+        && std::fgetc(f) != EOF;    // single whitespace before the data
+    if (!ok) {
+        std::cerr << "ERROR: '" << path << "' is not a PFM file.\n";
+        std::fclose(f);
+        return false;
+    }
+
+    const int channels = type[1] == 'F' ? 3 : 1;
+    const bool swap = (scale < 0) != pfm_writer::little_endian();
+    std::vector<float> line(static_cast<size_t>(w)*channels);
+
+    width = w;
+    height = h;
+    pixels.assign(static_cast<size_t>(w)*h*3, 0.0f);
+
+    // Stored bottom row first
+    for (int y=h-1;y>=0 && ok;y--){
+        ok = std::fread(line.data(), sizeof(float), line.size(), f) == line.size();
+        auto dst = row(y);
+        for (int x=0;x<w;x++)
+            for (int c=0;c<3;c++){
+                auto v = line[x*channels + (channels == 3 ? c : 0)];
+                dst[3*x + c] = swap ? pfm_writer::swap_bytes(v) : v;
+            }
+    }
+    std::fclose(f);
+
+    if (!ok)
+        std::cerr << "ERROR: '" << path << "' is truncated.\n";
+    return ok;
+}
+
+#endif
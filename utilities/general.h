@@ -5,6 +5,7 @@
 #include "math.h"
 #include <limits>
 #include <memory>
+#include <cstdint>
 #include <cstdlib>
 
 // Usings 
@@ -24,8 +25,30 @@ inline double degrees_to_radians(double degrees){
     return degrees * pi / 180.0;
 }
 
+// Each thread draws from its own xorshift64* generator, so threads neither
+// contend for nor share a sequence. seed_random restarts the calling thread's
+// sequence; the renderer reseeds it per pixel.
+inline uint64_t& random_state(){
+    thread_local uint64_t state = 0x853c49e6748fea9bull;
+    return state;
+}
+
+inline void seed_random(uint64_t seed){
+    // splitmix64, so that nearby seeds start far apart
+    uint64_t z = seed + 0x9e3779b97f4a7c15ull;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    z ^= z >> 31;
+    random_state() = z ? z : 1;
+}
+
+// In [0, 1)
 inline double random_double(){
-    return rand() / (RAND_MAX + 1.0);
+    auto& s = random_state();
+    s ^= s >> 12;
+    s ^= s << 25;
+    s ^= s >> 27;
+    return ((s * 0x2545f4914f6cdd1dull) >> 11) * (1.0 / 9007199254740992.0);
 }
 
 inline double random_double(double min, double max){
@@ -46,5 +69,7 @@ inline int random_int(int min, int max){
 
 #include "ray.h"
 #include "vec3.h"
+#include "stats.h"
+#include "arena.h"
 
 #endif
\ No newline at end of file
@@ -0,0 +1,74 @@
+#ifndef GLOBAL_MEDIUM_H
+#define GLOBAL_MEDIUM_H
+
+#include "general.h"
+
+#include "hittable.h"
+#include "material.h"
+#include "texture.h"
+
+// Homogeneous participating medium filling the scene (atmosphere, haze). It is
+// not a hittable: the integrator samples a free-flight distance on every ray
+// segment before the surface hit, so it costs no boundary intersections and
+// does not bloat the BVH. An optional sphere limits its extent.
+class global_medium {
+    public:
+        global_medium(
+            double d, color c, const point3& _center = point3(0, 0, 0), double _radius = infinity
+        ) : phase_function(make_scene_shared<isotropic>(c)), neg_inv_density(-1/d), center(_center), radius(_radius) {}
+
+        global_medium(
+            double d, shared_ptr<texture> t, const point3& _center = point3(0, 0, 0), double _radius = infinity
+        ) : phase_function(make_scene_shared<isotropic>(t)), neg_inv_density(-1/d), center(_center), radius(_radius) {}
+
+        // Returns true if r scatters in the medium between t_min and t_max, and fills
+        // rec with the scattering event.
+        bool sample(const ray& r, double t_min, double t_max, hit_record& rec) const;
+
+    public:
+        shared_ptr<material> phase_function;
+        double neg_inv_density;
+        point3 center;
+        double radius;
+};
+
+bool global_medium :: sample(const ray& r, double t_min, double t_max, hit_record& rec) const {
+    // Clip the segment against the extent sphere analytically
+    if (radius < infinity) {
+        auto oc = r.origin() - center;
+        auto a = r.direction().length_squared();
+        auto half_b = dot(oc, r.direction());
+        auto c = oc.length_squared() - radius*radius;
+        auto discriminant = half_b*half_b - a*c;
+        if (discriminant < 0)
+            return false;
+
+        auto sqrtd = sqrt(discriminant);
+        t_min = fmax(t_min, (-half_b - sqrtd) / a);
+        t_max = fmin(t_max, (-half_b + sqrtd) / a);
+    }
+
+    if (t_min >= t_max)
+        return false;
+
+    const auto ray_length = r.direction().length();
+    const auto hit_distance = neg_inv_density * log(random_double());
+
+    // Compare in parametric units so an unbounded segment needs no special case
+    const auto t = t_min + hit_distance / ray_length;
+    if (t >= t_max)
+        return false;
+
+    RT_STAT_INC(global_medium_scatters);
+    rec.t = t;
+    rec.p = r.at(rec.t);
+    rec.normal = vec3(1,0,0);  // arbitrary
+    rec.front_face = true;     // also arbitrary
+    rec.footprint = 0;
+    rec.mat_ptr = phase_function.get();
+    rec.u = rec.v = 0;
+
+    return true;
+}
+
+#endif
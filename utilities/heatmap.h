@@ -0,0 +1,91 @@
+#ifndef HEATMAP_H
+#define HEATMAP_H
+
+#include "general.h"
+
+#include "framebuffer.h"
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+// Per-pixel render cost: wall time, BVH nodes visited and path length (bounces
+// per sample). BVH visits come from the statistics counters and stay zero
+// unless built with RAY_TRACING_STATS.
+class heatmap_buffers {
+    public:
+        heatmap_buffers(int w, int h)
+          : width(w), height(h), seconds(static_cast<size_t>(w)*h, 0.0f),
+            bvh_visits(static_cast<size_t>(w)*h, 0.0f), path_length(static_cast<size_t>(w)*h, 0.0f) {}
+
+        // Snapshot of this thread's counters, taken before and after a pixel
+        static double bvh_visits_so_far() {
+#ifdef RAY_TRACING_STATS
+            return static_cast<double>(stats::local().values[stats::bvh_nodes_visited]);
+#else
+            return 0;
+#endif
+        }
+
+        // Pixel index i (row-major, top row first). Visits and path length are
+        // per sample.
+        void store(int i, double pixel_seconds, double visits, double bounces) {
+            seconds[i] = static_cast<float>(pixel_seconds);
+            bvh_visits[i] = static_cast<float>(visits);
+            path_length[i] = static_cast<float>(bounces);
+        }
+
+        // Dark blue through green and yellow to red, for t in [0, 1]
+        static color false_color(double t) {
+            static const color stops[] = {
+                color(0.05, 0.03, 0.25), color(0.10, 0.35, 0.85), color(0.10, 0.75, 0.45),
+                color(0.95, 0.85, 0.15), color(0.90, 0.15, 0.10)
+            };
+            const int last = sizeof(stops)/sizeof(stops[0]) - 1;
+            t = clamp(t, 0.0, 1.0) * last;
+            int i = std::min(static_cast<int>(t), last - 1);
+            auto f = t - i;
+            return (1-f)*stops[i] + f*stops[i+1];
+        }
+
+        // Writes <prefix>time, bvh and path as raw .pfm and false-color .png.
+        // Colors are scaled to the 99th percentile so a few outliers do not
+        // flatten the rest.
+        bool save(const std::string& prefix) const {
+            bool ok = save_plane(prefix + "time", seconds);
+            ok = save_plane(prefix + "path", path_length) && ok;
+            if (stats::enabled)
+                ok = save_plane(prefix + "bvh", bvh_visits) && ok;
+            return ok;
+        }
+
+    private:
+        bool save_plane(const std::string& path, const std::vector<float>& plane) const {
+            framebuffer raw(width, height), colored(width, height);
+
+            auto sorted = plane;
+            auto k = sorted.size() * 99 / 100;
+            std::nth_element(sorted.begin(), sorted.begin() + k, sorted.end());
+            auto scale = sorted[k] > 0 ? 1.0 / sorted[k] : 1.0;
+
+            for (int y=0;y<height;y++)
+                for (int x=0;x<width;x++){
+                    auto v = plane[static_cast<size_t>(y)*width + x];
+                    raw.set(x, y, color(v, v, v));
+
+                    // The 8-bit writers apply gamma 2, so store the square
+                    auto c = false_color(v * scale);
+                    colored.set(x, y, c * c);
+                }
+
+            return raw.save(path + ".pfm") && colored.save(path + ".png");
+        }
+
+    public:
+        int width, height;
+        std::vector<float> seconds;
+        std::vector<float> bvh_visits;
+        std::vector<float> path_length;
+};
+
+#endif
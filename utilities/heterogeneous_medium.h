@@ -0,0 +1,197 @@
+#ifndef HETEROGENEOUS_MEDIUM_H
+#define HETEROGENEOUS_MEDIUM_H
+
+#include "general.h"
+
+#include "density_grid.h"
+#include "hittable.h"
+#include "material.h"
+#include "texture.h"
+
+#include <vector>
+
+// Coarse grid of density upper bounds over a density field. Delta and ratio
+// tracking use the local bound of each cell, so steps through empty or thin
+// regions are long and empty cells are skipped outright.
+class majorant_grid {
+    public:
+        majorant_grid(const density_field& field, int resolution) : res(resolution) {
+            box = field.bounds();
+            auto extent = box.max() - box.min();
+            cell_size = extent / res;
+            values.resize(static_cast<size_t>(res)*res*res);
+
+            for (int k=0;k<res;k++)
+                for (int j=0;j<res;j++)
+                    for (int i=0;i<res;i++){
+                        auto lo = box.min() + vec3(i*cell_size.x(), j*cell_size.y(), k*cell_size.z());
+                        values[(static_cast<size_t>(k)*res + j)*res + i] = field.max_density(aabb(lo, lo + cell_size));
+                    }
+        }
+
+        double at(int i, int j, int k) const {
+            return values[(static_cast<size_t>(k)*res + j)*res + i];
+        }
+
+    public:
+        aabb box;
+        int res;
+        vec3 cell_size;
+        std::vector<double> values;
+};
+
+// 3D DDA over the cells of a majorant grid between t_min and t_max
+class majorant_iterator {
+    public:
+        majorant_iterator(const majorant_grid& _grid, const ray& r, double t_min, double t_max)
+            : grid(_grid), t(t_min), t_end(t_max) {
+            auto p = r.at(t_min);
+            auto d = r.direction();
+            for (int a=0;a<3;a++){
+                auto g = (p[a] - grid.box.min()[a]) / grid.cell_size[a];
+                cell[a] = static_cast<int>(clamp(floor(g), 0, grid.res-1));
+
+                if (d[a] == 0) {
+                    step[a] = 0;
+                    next_t[a] = infinity;
+                    delta_t[a] = infinity;
+                    continue;
+                }
+                step[a] = d[a] > 0 ? 1 : -1;
+                auto boundary = grid.box.min()[a] + (cell[a] + (d[a] > 0 ? 1 : 0)) * grid.cell_size[a];
+                next_t[a] = t_min + (boundary - p[a]) / d[a];
+                delta_t[a] = grid.cell_size[a] / fabs(d[a]);
+            }
+        }
+
+        // Current segment [t0, t1) and its majorant. Returns false once past t_max.
+        bool next(double& t0, double& t1, double& majorant) {
+            if (t >= t_end)
+                return false;
+
+            int a = (next_t[0] < next_t[1])
+                  ? (next_t[0] < next_t[2] ? 0 : 2)
+                  : (next_t[1] < next_t[2] ? 1 : 2);
+
+            t0 = t;
+            t1 = fmin(next_t[a], t_end);
+            majorant = grid.at(cell[0], cell[1], cell[2]);
+
+            t = t1;
+            cell[a] += step[a];
+            next_t[a] += delta_t[a];
+            if (cell[a] < 0 || cell[a] >= grid.res)
+                t_end = t;
+
+            return true;
+        }
+
+    private:
+        const majorant_grid& grid;
+        double t, t_end;
+        int cell[3];
+        int step[3];
+        double next_t[3];
+        double delta_t[3];
+};
+
+// Participating medium with spatially varying density (smoke, clouds). Free
+// paths are sampled with delta tracking against the majorant grid, and
+// transmittance along a segment is estimated with ratio tracking. The boundary
+// is the field's box, so no convexity assumption is needed.
+class heterogeneous_medium : public hittable {
+    public:
+        heterogeneous_medium(
+            shared_ptr<density_field> f, double scale, color c, int majorant_resolution = 16
+        ) : field(f), density_scale(scale), phase_function(make_scene_shared<isotropic>(c)),
+            majorants(*f, majorant_resolution) {}
+
+        heterogeneous_medium(
+            shared_ptr<density_field> f, double scale, shared_ptr<texture> t, int majorant_resolution = 16
+        ) : field(f), density_scale(scale), phase_function(make_scene_shared<isotropic>(t)),
+            majorants(*f, majorant_resolution) {}
+
+        virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override;
+
+        virtual bool bounding_box(double time0, double time1, aabb& output_bounding_box) const override {
+            output_bounding_box = field->bounds();
+            return true;
+        }
+
+        // Fraction of light that passes through the medium along r between t_min and t_max
+        double transmittance(const ray& r, double t_min, double t_max) const;
+
+    public:
+        shared_ptr<density_field> field;
+        double density_scale;
+        shared_ptr<material> phase_function;
+        majorant_grid majorants;
+};
+
+bool heterogeneous_medium :: hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
+    RT_STAT_INC(heterogeneous_medium_tests);
+    if (!majorants.box.clip(r, t_min, t_max))
+        return false;
+
+    const auto ray_length = r.direction().length();
+    majorant_iterator cells(majorants, r, t_min, t_max);
+    double t0, t1, majorant;
+
+    while (cells.next(t0, t1, majorant)) {
+        if (majorant <= 0)
+            continue;
+
+        auto sigma_max = majorant * density_scale;
+        auto t = t0;
+        while (true) {
+            t -= log(1 - random_double()) / (sigma_max * ray_length);
+            if (t >= t1)
+                break;
+
+            // Real collision with probability density / majorant, otherwise null
+            auto p = r.at(t);
+            if (random_double() * majorant < field->density(p)) {
+                RT_STAT_INC(heterogeneous_scatters);
+                rec.t = t;
+                rec.p = p;
+                rec.normal = vec3(1,0,0);  // arbitrary
+                rec.front_face = true;     // also arbitrary
+                rec.footprint = 0;
+                rec.mat_ptr = phase_function.get();
+                rec.u = rec.v = 0;
+                return true;
+            }
+            RT_STAT_INC(heterogeneous_null_collisions);
+        }
+    }
+
+    return false;
+}
+
+double heterogeneous_medium :: transmittance(const ray& r, double t_min, double t_max) const {
+    if (!majorants.box.clip(r, t_min, t_max))
+        return 1;
+
+    const auto ray_length = r.direction().length();
+    majorant_iterator cells(majorants, r, t_min, t_max);
+    double t0, t1, majorant;
+    double T = 1;
+
+    while (cells.next(t0, t1, majorant)) {
+        if (majorant <= 0)
+            continue;
+
+        auto sigma_max = majorant * density_scale;
+        auto t = t0;
+        while (true) {
+            t -= log(1 - random_double()) / (sigma_max * ray_length);
+            if (t >= t1)
+                break;
+            T *= 1 - field->density(r.at(t)) / majorant;
+        }
+    }
+
+    return T;
+}
+
+#endif
@@ -4,19 +4,30 @@
 #include "ray.h"
 #include "aabb.h"
 
+#include <cstdint>
+
 class material;
+class hittable;
 
 // Stores record of an intersection point
 struct hit_record{
     point3 p;
     vec3 normal;
     double t;
-    shared_ptr<material> mat_ptr;
+    // Owned by the scene; a plain pointer keeps hits free of reference counting
+    const material* mat_ptr = nullptr;
+
+    // Top-level object that was hit, set by the containing list or BVH
+    const hittable* object = nullptr;
 
     // These are coordinates in uv texture space
     double u;
     double v;
 
+    // Width of the ray's footprint at the hit, in uv units. Texture lookups use
+    // it to pick a mip level.
+    double footprint = 0;
+
     // normal always points outward
 
     bool front_face;
@@ -24,6 +35,13 @@ struct hit_record{
         front_face = (dot(r.direction(), outward_normal) < 0);
         normal = front_face ? outward_normal : -outward_normal;
     }
+
+    // Footprint of r's cone at t, given how many world units one uv unit spans.
+    // Needs normal to be set; grazing hits widen the footprint.
+    inline void set_footprint(const ray& r, double world_per_uv){
+        auto cos_theta = fabs(dot(unit_vector(r.direction()), normal));
+        footprint = r.footprint(t) / (fmax(cos_theta, 0.1) * world_per_uv);
+    }
 };
 
 // Abstract class for all hittable objects 
@@ -33,6 +51,19 @@ class hittable{
         virtual bool hit(const ray&r, double t_min, double t_max, hit_record& rec) const = 0;
         virtual bool bounding_box(double time0, double time1, aabb& output_bounding_box) const = 0;
 
+        // Bounds at time0 and time1. Objects that move linearly override this so
+        // that a BVH can interpolate its boxes by ray time instead of using the union.
+        virtual bool motion_bounding_box(double time0, double time1, aabb& box_start, aabb& box_end) const {
+            if (!bounding_box(time0, time1, box_start))
+                return false;
+            box_end = box_start;
+            return true;
+        }
+
+    public:
+        // Position among the scene's top-level objects from 1, set by scene_bvh
+        // for the object_id AOV; 0 for objects inside another
+        uint32_t id = 0;
 };
 
 // Handles the translation of objects
@@ -43,6 +74,7 @@ class translate : public hittable{
         
         virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override;
         virtual bool bounding_box(double time0, double time1, aabb& output_bounding_box) const override;
+        virtual bool motion_bounding_box(double time0, double time1, aabb& box_start, aabb& box_end) const override;
 
     public:
         shared_ptr<hittable> h_ptr;
@@ -50,12 +82,12 @@ class translate : public hittable{
 };
 
 bool translate :: hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
-    ray r_new(r.origin()-offset, r.direction(), r.time());
+    ray r_new(r.origin()-offset, r.direction(), r.time(), r.cone_width, r.cone_spread);
     if (!h_ptr->hit(r_new, t_min, t_max, rec))
         return false;
     
+    // Translation leaves the normal and the side it faces unchanged
     rec.p += offset;
-    rec.set_face_normal(r_new, rec.normal);
 
     return true;
 }
@@ -72,6 +104,16 @@ bool translate :: bounding_box(double time0, double time1, aabb& output_bounding
     return true;
 }
 
+bool translate :: motion_bounding_box(double time0, double time1, aabb& box_start, aabb& box_end) const {
+    if (!h_ptr->motion_bounding_box(time0, time1, box_start, box_end))
+        return false;
+
+    box_start = aabb(box_start.min() + offset, box_start.max() + offset);
+    box_end = aabb(box_end.min() + offset, box_end.max() + offset);
+
+    return true;
+}
+
 // Handles the rotation around y-axis
 class rotate_y : public hittable{
     public:
@@ -98,8 +140,8 @@ rotate_y :: rotate_y(shared_ptr<hittable> p, double angle) : h_ptr(p){
 
     hasBox = h_ptr->bounding_box(0, 1, bbox);
 
-    auto min = vec3(-infinity, -infinity, -infinity);
-    auto max = vec3(infinity, infinity, infinity);
+    auto min = vec3(infinity, infinity, infinity);
+    auto max = vec3(-infinity, -infinity, -infinity);
 
     for (int i=0;i<2;i++){
         for (int j=0;j<2;j++){
@@ -128,27 +170,23 @@ bool rotate_y :: hit(const ray& r, double t_min, double t_max, hit_record& rec)
     auto origin = r.origin();
     auto direction = r.direction();
 
-    origin[0] = cos_theta*origin[0] - sin_theta*origin[2];
-    origin[2] = sin_theta*origin[0] + cos_theta*origin[2];
+    // Rotate into object space; both components are computed from the originals
+    origin = vec3(cos_theta*r.origin()[0] - sin_theta*r.origin()[2], origin[1],
+                  sin_theta*r.origin()[0] + cos_theta*r.origin()[2]);
 
-    direction[0] = cos_theta*direction[0] - sin_theta*direction[2];
-    direction[2] = sin_theta*direction[0] + cos_theta*direction[2];
+    direction = vec3(cos_theta*r.direction()[0] - sin_theta*r.direction()[2], direction[1],
+                     sin_theta*r.direction()[0] + cos_theta*r.direction()[2]);
 
-    ray rotated_r(origin, direction, r.time());
+    ray rotated_r(origin, direction, r.time(), r.cone_width, r.cone_spread);
     if (!h_ptr->hit(rotated_r, t_min, t_max, rec))
         return false;
     
     auto p = rec.p;
     auto normal = rec.normal;
 
-    p[0] = cos_theta*p[0] + sin_theta*p[2];
-    p[2] = -sin_theta*p[0] + cos_theta*p[2];
-
-    normal[0] = cos_theta*normal[0] + sin_theta*normal[2];
-    normal[2] = -sin_theta*normal[0] + cos_theta*normal[2];
-
-    rec.p = p;
-    rec.set_face_normal(rotated_r, normal);
+    // Rotation keeps the normal on the same side of the ray, so front_face holds
+    rec.p = vec3(cos_theta*p[0] + sin_theta*p[2], p[1], -sin_theta*p[0] + cos_theta*p[2]);
+    rec.normal = vec3(cos_theta*normal[0] + sin_theta*normal[2], normal[1], -sin_theta*normal[0] + cos_theta*normal[2]);
 
     return true;
 }
@@ -35,6 +35,7 @@ bool hittable_list :: hit(const ray& r, double t_min, double t_max, hit_record&
             hit_anything = true;
             closest_so_far = temp_rec.t;
             rec = temp_rec;
+            rec.object = object.get();
         }
     }
     return hit_anything;
@@ -0,0 +1,508 @@
+#ifndef IMAGE_WRITER_H
+#define IMAGE_WRITER_H
+
+#include "general.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#ifdef RAY_TRACING_HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+// Linear radiance to an 8-bit display value: gamma 2, clamped
+inline unsigned char to_display_byte(float x) {
+    return static_cast<unsigned char>(256*clamp(sqrt(fmax(x, 0.0)), 0, 0.999));
+}
+
+// Writes an image one scanline at a time, top row first. Rows are linear float
+// RGB; each format does its own encoding, so nothing holds the whole image.
+class image_writer {
+    public:
+        virtual ~image_writer() {
+            if (out)
+                std::fclose(out);
+        }
+
+        bool open(const std::string& path, int w, int h) {
+            width = w;
+            height = h;
+            out = std::fopen(path.c_str(), "wb");
+            if (!out) {
+                std::cerr << "ERROR: Could not open '" << path << "' for writing.\n";
+                return false;
+            }
+            return begin();
+        }
+
+        virtual bool write_row(const float* rgb) = 0;
+
+        bool close() {
+            if (!out)
+                return false;
+            bool ok = finish();
+            ok = (std::fclose(out) == 0) && ok;
+            out = nullptr;
+            return ok;
+        }
+
+    protected:
+        virtual bool begin() = 0;
+        virtual bool finish() { return true; }
+
+        bool put(const void* data, size_t n) {
+            return std::fwrite(data, 1, n, out) == n;
+        }
+
+    protected:
+        std::FILE* out = nullptr;
+        int width = 0, height = 0;
+};
+
+// Binary PPM (P6)
+class ppm_writer : public image_writer {
+    public:
+        virtual bool write_row(const float* rgb) override {
+            row.resize(static_cast<size_t>(width)*3);
+            for (size_t i=0;i<row.size();i++)
+                row[i] = to_display_byte(rgb[i]);
+            return put(row.data(), row.size());
+        }
+
+    protected:
+        virtual bool begin() override {
+            return std::fprintf(out, "P6\n%d %d\n255\n", width, height) > 0;
+        }
+
+    private:
+        std::vector<unsigned char> row;
+};
+
+// 8-bit RGB PNG. Rows use the Sub filter and are deflated as they arrive; the
+// compressed stream goes out in IDAT chunks. Without zlib the deflate stream
+// is made of stored (uncompressed) blocks.
+class png_writer : public image_writer {
+    public:
+        ~png_writer() {
+#ifdef RAY_TRACING_HAVE_ZLIB
+            if (stream_open)
+                deflateEnd(&stream);
+#endif
+        }
+
+        virtual bool write_row(const float* rgb) override {
+            // Filter byte, then each byte minus the same channel of the previous pixel
+            row.resize(1 + static_cast<size_t>(width)*3);
+            row[0] = 1;
+            unsigned char prev[3] = {0, 0, 0};
+            for (int i=0;i<width*3;i++){
+                auto b = to_display_byte(rgb[i]);
+                row[1+i] = static_cast<unsigned char>(b - prev[i%3]);
+                prev[i%3] = b;
+            }
+            return compress(row.data(), row.size(), false);
+        }
+
+    protected:
+        virtual bool begin() override {
+            static const unsigned char signature[8] = {137, 'P', 'N', 'G', '\r', '\n', 26, '\n'};
+            unsigned char ihdr[13];
+            store_be32(ihdr, width);
+            store_be32(ihdr + 4, height);
+            ihdr[8] = 8;    // bit depth
+            ihdr[9] = 2;    // truecolor
+            ihdr[10] = ihdr[11] = ihdr[12] = 0;
+            if (!put(signature, 8) || !chunk("IHDR", ihdr, 13))
+                return false;
+
+#ifdef RAY_TRACING_HAVE_ZLIB
+            std::memset(&stream, 0, sizeof(stream));
+            stream_open = deflateInit(&stream, 6) == Z_OK;
+            return stream_open;
+#else
+            adler_a = 1;
+            adler_b = 0;
+            const unsigned char zlib_header[2] = {0x78, 0x01};
+            pending.assign(zlib_header, zlib_header + 2);
+            return true;
+#endif
+        }
+
+        virtual bool finish() override {
+            return compress(nullptr, 0, true) && chunk("IEND", nullptr, 0);
+        }
+
+    private:
+        static void store_be32(unsigned char* p, uint32_t v) {
+            p[0] = static_cast<unsigned char>(v >> 24);
+            p[1] = static_cast<unsigned char>(v >> 16);
+            p[2] = static_cast<unsigned char>(v >> 8);
+            p[3] = static_cast<unsigned char>(v);
+        }
+
+        static uint32_t crc(uint32_t c, const unsigned char* data, size_t n) {
+#ifdef RAY_TRACING_HAVE_ZLIB
+            return static_cast<uint32_t>(crc32(c, data, static_cast<uInt>(n)));
+#else
+            static uint32_t table[256];
+            static bool table_ready = false;
+            if (!table_ready) {
+                for (uint32_t i=0;i<256;i++){
+                    uint32_t k = i;
+                    for (int j=0;j<8;j++)
+                        k = (k & 1) ? 0xedb88320u ^ (k >> 1) : k >> 1;
+                    table[i] = k;
+                }
+                table_ready = true;
+            }
+            c = ~c;
+            for (size_t i=0;i<n;i++)
+                c = table[(c ^ data[i]) & 255] ^ (c >> 8);
+            return ~c;
+#endif
+        }
+
+        bool chunk(const char* type, const unsigned char* data, size_t n) {
+            unsigned char head[8];
+            store_be32(head, static_cast<uint32_t>(n));
+            std::memcpy(head + 4, type, 4);
+            auto c = crc(0, head + 4, 4);
+            if (n)
+                c = crc(c, data, n);
+            unsigned char tail[4];
+            store_be32(tail, c);
+            return put(head, 8) && (n == 0 || put(data, n)) && put(tail, 4);
+        }
+
+        // Feeds n bytes to the deflate stream and writes out full IDAT chunks
+        bool compress(const unsigned char* data, size_t n, bool last) {
+            const size_t idat_size = 1 << 16;
+#ifdef RAY_TRACING_HAVE_ZLIB
+            unsigned char buffer[1 << 14];
+            stream.next_in = const_cast<unsigned char*>(data);
+            stream.avail_in = static_cast<uInt>(n);
+            int status;
+            do {
+                stream.next_out = buffer;
+                stream.avail_out = sizeof(buffer);
+                status = deflate(&stream, last ? Z_FINISH : Z_NO_FLUSH);
+                if (status == Z_STREAM_ERROR)
+                    return false;
+                pending.insert(pending.end(), buffer, buffer + (sizeof(buffer) - stream.avail_out));
+            } while (stream.avail_out == 0 || (last && status != Z_STREAM_END));
+#else
+            // Stored blocks of at most 65535 bytes, then the adler32 trailer
+            while (n > 0 || last) {
+                auto len = std::min<size_t>(n, 65535);
+                bool final_block = last && len == n;
+                pending.push_back(final_block ? 1 : 0);
+                pending.push_back(static_cast<unsigned char>(len));
+                pending.push_back(static_cast<unsigned char>(len >> 8));
+                pending.push_back(static_cast<unsigned char>(~len));
+                pending.push_back(static_cast<unsigned char>(~len >> 8));
+                for (size_t i=0;i<len;i++){
+                    adler_a = (adler_a + data[i]) % 65521;
+                    adler_b = (adler_b + adler_a) % 65521;
+                }
+                pending.insert(pending.end(), data, data + len);
+                data += len;
+                n -= len;
+                if (final_block) {
+                    unsigned char adler[4];
+                    store_be32(adler, (adler_b << 16) | adler_a);
+                    pending.insert(pending.end(), adler, adler + 4);
+                    break;
+                }
+            }
+#endif
+            while (pending.size() >= idat_size || (last && !pending.empty())) {
+                auto len = std::min(pending.size(), idat_size);
+                if (!chunk("IDAT", pending.data(), len))
+                    return false;
+                pending.erase(pending.begin(), pending.begin() + len);
+            }
+            return true;
+        }
+
+    private:
+        std::vector<unsigned char> row;
+        std::vector<unsigned char> pending;     // compressed bytes not yet in an IDAT
+#ifdef RAY_TRACING_HAVE_ZLIB
+        z_stream stream;
+        bool stream_open = false;
+#else
+        uint32_t adler_a = 1, adler_b = 0;
+#endif
+};
+
+// Radiance RGBE (.hdr), run-length encoded per channel. Keeps linear radiance.
+class hdr_writer : public image_writer {
+    public:
+        virtual bool write_row(const float* rgb) override {
+            rgbe.resize(static_cast<size_t>(width)*4);
+            for (int x=0;x<width;x++)
+                to_rgbe(rgb + 3*x, &rgbe[4*x]);
+
+            // The RLE scheme only covers widths of 8 to 32767
+            if (width < 8 || width > 0x7fff)
+                return put(rgbe.data(), rgbe.size());
+
+            encoded.clear();
+            encoded.push_back(2);
+            encoded.push_back(2);
+            encoded.push_back(static_cast<unsigned char>(width >> 8));
+            encoded.push_back(static_cast<unsigned char>(width & 255));
+            for (int c=0;c<4;c++)
+                encode_channel(c);
+            return put(encoded.data(), encoded.size());
+        }
+
+    protected:
+        virtual bool begin() override {
+            return std::fprintf(out, "#?RADIANCE\nFORMAT=32-bit_rle_rgbe\n\n-Y %d +X %d\n", height, width) > 0;
+        }
+
+    private:
+        static void to_rgbe(const float* c, unsigned char* e) {
+            auto v = fmax(c[0], fmax(c[1], c[2]));
+            if (!(v > 1e-32)) {
+                e[0] = e[1] = e[2] = e[3] = 0;
+                return;
+            }
+            int exponent;
+            auto scale = frexp(v, &exponent) * 256.0 / v;
+            e[0] = static_cast<unsigned char>(fmax(c[0], 0.0) * scale);
+            e[1] = static_cast<unsigned char>(fmax(c[1], 0.0) * scale);
+            e[2] = static_cast<unsigned char>(fmax(c[2], 0.0) * scale);
+            e[3] = static_cast<unsigned char>(exponent + 128);
+        }
+
+        // Runs of 4 or more equal bytes become (128+count, byte); the rest are
+        // written as literal spans of at most 128 bytes
+        void encode_channel(int c) {
+            auto at = [&](int x) { return rgbe[4*x + c]; };
+            int x = 0;
+            while (x < width) {
+                int run = 1;
+                while (x + run < width && run < 127 && at(x + run) == at(x))
+                    run++;
+                if (run >= 4) {
+                    encoded.push_back(static_cast<unsigned char>(128 + run));
+                    encoded.push_back(at(x));
+                    x += run;
+                    continue;
+                }
+
+                // Literal span up to the next run of 4
+                int start = x;
+                while (x < width && x - start < 128) {
+                    if (x + 3 < width && at(x) == at(x+1) && at(x) == at(x+2) && at(x) == at(x+3))
+                        break;
+                    x++;
+                }
+                encoded.push_back(static_cast<unsigned char>(x - start));
+                for (int i=start;i<x;i++)
+                    encoded.push_back(at(i));
+            }
+        }
+
+    private:
+        std::vector<unsigned char> rgbe;
+        std::vector<unsigned char> encoded;
+};
+
+// Portable float map (.pfm), little-endian float RGB. The format stores rows
+// bottom to top, so each row is written at its final offset as it arrives.
+class pfm_writer : public image_writer {
+    public:
+        virtual bool write_row(const float* rgb) override {
+            auto row_bytes = static_cast<long>(width) * 3 * sizeof(float);
+            auto offset = data_start + (height - 1 - rows_written) * row_bytes;
+            rows_written++;
+            if (std::fseek(out, offset, SEEK_SET) != 0)
+                return false;
+
+            if (little_endian())
+                return put(rgb, row_bytes);
+
+            row.resize(static_cast<size_t>(width)*3);
+            for (size_t i=0;i<row.size();i++)
+                row[i] = swap_bytes(rgb[i]);
+            return put(row.data(), row_bytes);
+        }
+
+        static bool little_endian() {
+            const uint16_t one = 1;
+            return *reinterpret_cast<const unsigned char*>(&one) == 1;
+        }
+
+        static float swap_bytes(float f) {
+            unsigned char b[4];
+            std::memcpy(b, &f, 4);
+            std::swap(b[0], b[3]);
+            std::swap(b[1], b[2]);
+            std::memcpy(&f, b, 4);
+            return f;
+        }
+
+    protected:
+        virtual bool begin() override {
+            // Negative scale marks little-endian data
+            if (std::fprintf(out, "PF\n%d %d\n-1.0\n", width, height) <= 0)
+                return false;
+            data_start = std::ftell(out);
+            return data_start > 0;
+        }
+
+    private:
+        long data_start = 0;
+        int rows_written = 0;
+        std::vector<float> row;
+};
+
+// Picks the writer from the file extension (.ppm, .png, .hdr or .pfm)
+inline std::unique_ptr<image_writer> make_image_writer(const std::string& path) {
+    auto dot = path.rfind('.');
+    auto ext = dot == std::string::npos ? std::string() : path.substr(dot + 1);
+    if (ext == "ppm")
+        return std::unique_ptr<image_writer>(new ppm_writer());
+    if (ext == "png")
+        return std::unique_ptr<image_writer>(new png_writer());
+    if (ext == "hdr")
+        return std::unique_ptr<image_writer>(new hdr_writer());
+    if (ext == "pfm")
+        return std::unique_ptr<image_writer>(new pfm_writer());
+
+    std::cerr << "ERROR: Unknown image format '" << path << "'.\n";
+    return nullptr;
+}
+
+// Streams a render to one or more files from a background thread. Rows or
+// tiles can be submitted in any order as they finish; rows are handed to the
+// writers in order as soon as they are complete, so encoding overlaps
+// rendering and only unfinished or out-of-order rows are held in memory.
+class image_output {
+    public:
+        image_output(int w, int h) : width(w), height(h) {}
+
+        ~image_output() {
+            finish();
+        }
+
+        image_output(const image_output&) = delete;
+        image_output& operator=(const image_output&) = delete;
+
+        // Adds a file to write; call before submitting any rows
+        bool add(const std::string& path) {
+            auto writer = make_image_writer(path);
+            if (!writer || !writer->open(path, width, height))
+                return false;
+            writers.push_back(std::move(writer));
+            if (!worker.joinable())
+                worker = std::thread([this]{ run(); });
+            return true;
+        }
+
+        // Row y (0 at the top) of width linear RGB pixels
+        void submit_row(int y, const float* rgb) {
+            std::vector<float> row(rgb, rgb + static_cast<size_t>(width)*3);
+            {
+                std::lock_guard<std::mutex> lock(m);
+                ready[y] = std::move(row);
+            }
+            cv.notify_one();
+        }
+
+        // A w x h block at (x0, y0), rows of w pixels. A row is passed on once
+        // all of its tiles have arrived.
+        void submit_tile(int x0, int y0, int w, int h, const float* rgb) {
+            std::unique_lock<std::mutex> lock(m);
+            bool completed = false;
+            for (int y=y0;y<y0+h;y++){
+                auto& p = partial[y];
+                if (p.first.empty()) {
+                    p.first.resize(static_cast<size_t>(width)*3);
+                    p.second = width;
+                }
+                std::memcpy(&p.first[static_cast<size_t>(x0)*3], rgb + static_cast<size_t>(y-y0)*w*3, sizeof(float)*w*3);
+                p.second -= w;
+                if (p.second <= 0) {
+                    ready[y] = std::move(p.first);
+                    partial.erase(y);
+                    completed = true;
+                }
+            }
+            lock.unlock();
+            if (completed)
+                cv.notify_one();
+        }
+
+        // Waits until every submitted row is written and closes the files.
+        // Returns false if a write failed or rows are missing.
+        bool finish() {
+            if (worker.joinable()) {
+                {
+                    std::lock_guard<std::mutex> lock(m);
+                    finishing = true;
+                }
+                cv.notify_one();
+                worker.join();
+            }
+
+            bool ok = !failed;
+            if (!writers.empty() && next_row != height) {
+                std::cerr << "ERROR: Image output ended after " << next_row << " of " << height << " rows.\n";
+                ok = false;
+            }
+            for (auto& w : writers)
+                ok = w->close() && ok;
+            writers.clear();
+            return ok;
+        }
+
+    private:
+        void run() {
+            std::unique_lock<std::mutex> lock(m);
+            while (next_row < height) {
+                cv.wait(lock, [this]{ return finishing || ready.count(next_row); });
+                auto it = ready.find(next_row);
+                if (it == ready.end())
+                    return;     // finishing with rows missing
+
+                auto row = std::move(it->second);
+                ready.erase(it);
+                lock.unlock();
+                for (auto& w : writers)
+                    if (!w->write_row(row.data()))
+                        failed = true;
+                lock.lock();
+                next_row++;
+            }
+        }
+
+    private:
+        int width, height;
+        std::vector<std::unique_ptr<image_writer>> writers;
+
+        std::mutex m;
+        std::condition_variable cv;
+        std::thread worker;
+        std::map<int, std::vector<float>> ready;
+        std::unordered_map<int, std::pair<std::vector<float>, int>> partial;   // row, pixels missing
+        int next_row = 0;
+        bool finishing = false;
+        bool failed = false;
+};
+
+#endif
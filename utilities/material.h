@@ -4,37 +4,61 @@
 #include "general.h"
 #include "hittable.h"
 #include "texture.h"
+#include "texture_program.h"
+
+#include <atomic>
+#include <cstdint>
 
 struct hit_record;
 
 class material{
 
     public:
-        
+        material() : id(next_id()++) {}
+
+        // Numbers the materials created from now on from 1 again. select_scene
+        // calls it, so a scene's material ids are the same in every run.
+        static void reset_ids() { next_id() = 1; }
+
         virtual color emitted(double u, double v, const point3& p) const {
             return color(0, 0, 0);
         }
 
         virtual bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered) const = 0;
+
+    public:
+        // Creation order within the scene, for the material_id AOV and path captures
+        uint32_t id;
+
+    private:
+        static std::atomic<uint32_t>& next_id() {
+            static std::atomic<uint32_t> next{1};
+            return next;
+        }
 };
 
+// Extra cone spread (radians) added by a diffuse bounce
+const double diffuse_spread = 0.2;
+
 class lambertian : public material{
 
     public:
-        lambertian(const color& a) : albedo(make_shared<solid_color>(a)){};
-        lambertian(shared_ptr<texture> a) : albedo(a){}
+        lambertian(const color& a) : albedo(make_scene_shared<solid_color>(a)){};
+        lambertian(shared_ptr<texture> a) : albedo(compile_texture(a)){}
 
         virtual bool scatter(
             const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered
          ) const override {
+            RT_STAT_INC(lambertian_scatters);
             auto scatter_direction = rec.normal + random_unit_vector();
 
             // Degenerate scatter direction 
             if (scatter_direction.near_zero())
                 scatter_direction = rec.normal;
     
-            scattered = ray(rec.p, scatter_direction, r_in.time());
-            attenuation = albedo->value(rec.u, rec.v, rec.p);
+            // Diffuse bounces blur whatever they see, so widen the cone a lot
+            scattered = ray(rec.p, scatter_direction, r_in.time(), r_in.footprint(rec.t), r_in.cone_spread + diffuse_spread);
+            attenuation = albedo->value(rec.u, rec.v, rec.p, rec.footprint);
             return true;
         }
     
@@ -50,9 +74,11 @@ class metal : public material{
         virtual bool scatter(
             const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered
          ) const override {
+            RT_STAT_INC(metal_scatters);
             
             auto scatter_direction = reflect(unit_vector(r_in.direction()), rec.normal);
-            scattered = ray(rec.p, scatter_direction + fuzz*random_in_unit_sphere(), r_in.time());
+            scattered = ray(rec.p, scatter_direction + fuzz*random_in_unit_sphere(), r_in.time(),
+                            r_in.footprint(rec.t), r_in.cone_spread + fuzz);
             attenuation = albedo;
             return dot(scattered.direction(), rec.normal) > 0;
         }
@@ -70,6 +96,7 @@ class dielectric : public material {
         virtual bool scatter(
             const ray& r_in, const hit_record& rec, color& attentuation, ray& scattered
         ) const override {
+            RT_STAT_INC(dielectric_scatters);
             attentuation = color(1.0, 1.0, 1.0);
             // If ray is from air into material or vice-versa
             double refractive_ratio = rec.front_face ? (1.0/ir) : ir;
@@ -85,7 +112,7 @@ class dielectric : public material {
             else
                 direction = refract(unit_direction, rec.normal, refractive_ratio);
             
-            scattered = ray(rec.p, direction, r_in.time());
+            scattered = ray(rec.p, direction, r_in.time(), r_in.footprint(rec.t), r_in.cone_spread);
             return true;
         }
 
@@ -105,11 +132,12 @@ class dielectric : public material {
 class diffuse_light : public material {
     public:
         diffuse_light(shared_ptr<texture> t) : emit(t){}
-        diffuse_light(color c) : emit(make_shared<solid_color>(c)){}
+        diffuse_light(color c) : emit(make_scene_shared<solid_color>(c)){}
 
         virtual bool scatter(
             const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered
         ) const override {
+            RT_STAT_INC(diffuse_light_scatters);
             // auto scatter_direction = rec.normal + random_unit_vector();
 
             // // Degenerate scatter direction 
@@ -132,13 +160,14 @@ class diffuse_light : public material {
 
 class isotropic : public material {
     public:
-        isotropic(color c) : albedo(make_shared<solid_color>(c)){}
-        isotropic(shared_ptr<texture> t) : albedo(t) {}
+        isotropic(color c) : albedo(make_scene_shared<solid_color>(c)){}
+        isotropic(shared_ptr<texture> t) : albedo(compile_texture(t)) {}
 
         virtual bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered
         ) const override {
-            scattered = ray(rec.p, random_in_unit_sphere(), r_in.time());
-            attenuation = albedo->value(rec.u, rec.v, rec.p);
+            RT_STAT_INC(isotropic_scatters);
+            scattered = ray(rec.p, random_in_unit_sphere(), r_in.time(), r_in.footprint(rec.t), r_in.cone_spread + diffuse_spread);
+            attenuation = albedo->value(rec.u, rec.v, rec.p, rec.footprint);
             return true;
         }
 
@@ -0,0 +1,324 @@
+#ifndef MEMORY_REPORT_H
+#define MEMORY_REPORT_H
+
+#include "general.h"
+
+#include "aarect.h"
+#include "aov.h"
+#include "box.h"
+#include "bvh.h"
+#include "constant_medium.h"
+#include "density_grid.h"
+#include "framebuffer.h"
+#include "global_medium.h"
+#include "heatmap.h"
+#include "heterogeneous_medium.h"
+#include "hittable_list.h"
+#include "material.h"
+#include "moving_sphere.h"
+#include "sparse_volume.h"
+#include "sphere.h"
+#include "texture.h"
+#include "texture_cache.h"
+#include "texture_program.h"
+#include "transform.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <set>
+#include <string>
+#include <vector>
+
+// Bytes held by a scene and the render around it, by category and type.
+// Objects count their own size plus the vectors and arrays they own; shared
+// objects (materials, textures, instanced geometry) are counted once. Figures
+// leave out allocator overhead, so compare the arena line for the real total.
+// File-backed memory (texture mip levels, mapped volumes) is listed but not
+// added to the total.
+class memory_report {
+    public:
+        struct entry {
+            std::string category;
+            std::string type;
+            size_t bytes = 0;
+            size_t count = 0;
+            bool file_backed = false;
+        };
+
+        void add(const std::string& category, const std::string& type, size_t bytes, size_t count = 1,
+                 bool file_backed = false) {
+            auto& e = find(category, type, file_backed);
+            e.bytes += bytes;
+            e.count += count;
+        }
+
+        // Like add, but replaces what an earlier call recorded
+        void set(const std::string& category, const std::string& type, size_t bytes, size_t count = 1,
+                 bool file_backed = false) {
+            auto& e = find(category, type, file_backed);
+            e.bytes = bytes;
+            e.count = count;
+        }
+
+        // Walks the scene graph under object: primitives, BVH nodes, instances,
+        // media, and the materials and textures they use
+        void add_scene(const hittable& object);
+        void add_medium(const global_medium& fog);
+
+        // Tiles resident in the texture cache now; call again to update
+        void add_texture_cache() {
+            auto& cache = texture_cache::global();
+            set("textures", "cache (resident tiles)", cache.resident_bytes());
+        }
+
+        void add_framebuffer(const std::string& name, const framebuffer& image) {
+            add("framebuffers", name, vector_bytes(image.pixels));
+        }
+        void add_framebuffer(const aov_buffers& aovs) {
+            add("framebuffers", "aovs", vector_bytes(aovs.albedo) + vector_bytes(aovs.normal) + vector_bytes(aovs.depth)
+                + vector_bytes(aovs.variance) + vector_bytes(aovs.object_id) + vector_bytes(aovs.material_id)
+                + vector_bytes(aovs.sample_count));
+        }
+        void add_framebuffer(const heatmap_buffers& heat) {
+            add("framebuffers", "heatmap", vector_bytes(heat.seconds) + vector_bytes(heat.bvh_visits)
+                + vector_bytes(heat.path_length));
+        }
+
+        // In-memory bytes; file-backed entries are left out
+        size_t total() const;
+
+        void print(std::ostream& out, const std::string& title) const;
+        bool write_json(const std::string& path) const;
+
+    public:
+        std::vector<entry> entries;     // in the order first added
+
+    private:
+        entry& find(const std::string& category, const std::string& type, bool file_backed) {
+            for (auto& e : entries)
+                if (e.category == category && e.type == type)
+                    return e;
+            entries.push_back(entry());
+            entries.back().category = category;
+            entries.back().type = type;
+            entries.back().file_backed = file_backed;
+            return entries.back();
+        }
+
+        // True the first time p is seen
+        bool first_visit(const void* p) { return p && seen.insert(p).second; }
+
+        template <typename T>
+        static size_t vector_bytes(const std::vector<T>& v) { return v.capacity() * sizeof(T); }
+
+        void add_density(const density_field* field);
+        void add_material(const material* m);
+        void add_texture(const texture* t);
+
+    private:
+        std::set<const void*> seen;
+        std::set<int> images;           // texture cache handles
+};
+
+void memory_report :: add_scene(const hittable& object) {
+    if (!first_visit(&object))
+        return;
+
+    // Primitives
+    if (auto s = dynamic_cast<const sphere*>(&object)) {
+        add("primitives", "sphere", sizeof(sphere));
+        add_material(s->mat_ptr.get());
+    } else if (auto s = dynamic_cast<const moving_sphere*>(&object)) {
+        add("primitives", "moving_sphere", sizeof(moving_sphere));
+        add_material(s->mat_ptr.get());
+    } else if (auto r = dynamic_cast<const xy_rect*>(&object)) {
+        add("primitives", "xy_rect", sizeof(xy_rect));
+        add_material(r->mat_ptr.get());
+    } else if (auto r = dynamic_cast<const xz_rect*>(&object)) {
+        add("primitives", "xz_rect", sizeof(xz_rect));
+        add_material(r->mat_ptr.get());
+    } else if (auto r = dynamic_cast<const yz_rect*>(&object)) {
+        add("primitives", "yz_rect", sizeof(yz_rect));
+        add_material(r->mat_ptr.get());
+    } else if (auto b = dynamic_cast<const box*>(&object)) {
+        // The sides are counted as rects
+        add("primitives", "box", sizeof(box) + vector_bytes(b->sides.objects));
+        add_material(b->mat_ptr.get());
+        for (const auto& side : b->sides.objects)
+            add_scene(*side);
+
+    // Acceleration structure
+    } else if (auto node = dynamic_cast<const bvh_node*>(&object)) {
+        add("bvh", "bvh_node", sizeof(bvh_node));
+        add_scene(*node->left);
+        add_scene(*node->right);
+    } else if (auto cb = dynamic_cast<const compressed_bvh*>(&object)) {
+        add("bvh", "compressed_bvh", sizeof(compressed_bvh));
+        add("bvh", "compressed_bvh::node", vector_bytes(cb->nodes), cb->nodes.size());
+        add("bvh", "compressed_bvh primitives", vector_bytes(cb->primitives), cb->primitives.size());
+        for (const auto& o : cb->primitives)
+            add_scene(*o);
+    } else if (auto sb = dynamic_cast<const scene_bvh*>(&object)) {
+        add("bvh", "scene_bvh", sizeof(scene_bvh) + vector_bytes(sb->unbounded.objects));
+        if (sb->bounded)
+            add_scene(*sb->bounded);
+        for (const auto& o : sb->unbounded.objects)
+            add_scene(*o);
+
+    // Groups and instances
+    } else if (auto list = dynamic_cast<const hittable_list*>(&object)) {
+        add("instances", "hittable_list", sizeof(hittable_list) + vector_bytes(list->objects));
+        for (const auto& o : list->objects)
+            add_scene(*o);
+    } else if (auto tf = dynamic_cast<const transform*>(&object)) {
+        add("instances", "transform", sizeof(transform));
+        add_scene(*tf->h_ptr);
+    } else if (auto tr = dynamic_cast<const translate*>(&object)) {
+        add("instances", "translate", sizeof(translate));
+        add_scene(*tr->h_ptr);
+    } else if (auto ro = dynamic_cast<const rotate_y*>(&object)) {
+        add("instances", "rotate_y", sizeof(rotate_y));
+        add_scene(*ro->h_ptr);
+
+    // Media
+    } else if (auto cm = dynamic_cast<const constant_medium*>(&object)) {
+        add("media", "constant_medium", sizeof(constant_medium));
+        add_scene(*cm->boundary);
+        add_material(cm->phase_function.get());
+    } else if (auto hm = dynamic_cast<const heterogeneous_medium*>(&object)) {
+        add("media", "heterogeneous_medium", sizeof(heterogeneous_medium) + vector_bytes(hm->majorants.values));
+        add_material(hm->phase_function.get());
+        add_density(hm->field.get());
+
+    } else {
+        add("other", "hittable", sizeof(hittable));
+    }
+}
+
+void memory_report :: add_medium(const global_medium& fog) {
+    if (!first_visit(&fog))
+        return;
+    add("media", "global_medium", sizeof(global_medium));
+    add_material(fog.phase_function.get());
+}
+
+void memory_report :: add_density(const density_field* field) {
+    if (!first_visit(field))
+        return;
+    if (auto grid = dynamic_cast<const dense_grid*>(field)) {
+        add("media", "dense_grid", sizeof(dense_grid) + vector_bytes(grid->values));
+    } else if (auto volume = dynamic_cast<const sparse_volume*>(field)) {
+        add("media", "sparse_volume", sizeof(sparse_volume));
+        add("media", "sparse_volume (mapped file)", volume->mapped_bytes(), 1, true);
+    } else {
+        add("media", "other density_field", sizeof(density_field));
+    }
+}
+
+void memory_report :: add_material(const material* m) {
+    if (!first_visit(m))
+        return;
+    if (auto l = dynamic_cast<const lambertian*>(m)) {
+        add("materials", "lambertian", sizeof(lambertian));
+        add_texture(l->albedo.get());
+    } else if (dynamic_cast<const metal*>(m)) {
+        add("materials", "metal", sizeof(metal));
+    } else if (dynamic_cast<const dielectric*>(m)) {
+        add("materials", "dielectric", sizeof(dielectric));
+    } else if (auto d = dynamic_cast<const diffuse_light*>(m)) {
+        add("materials", "diffuse_light", sizeof(diffuse_light));
+        add_texture(d->emit.get());
+    } else if (auto i = dynamic_cast<const isotropic*>(m)) {
+        add("materials", "isotropic", sizeof(isotropic));
+        add_texture(i->albedo.get());
+    } else {
+        add("materials", "other", sizeof(material));
+    }
+}
+
+void memory_report :: add_texture(const texture* t) {
+    if (!first_visit(t))
+        return;
+    if (dynamic_cast<const solid_color*>(t)) {
+        add("textures", "solid_color", sizeof(solid_color));
+    } else if (auto c = dynamic_cast<const checker_texture*>(t)) {
+        add("textures", "checker_texture", sizeof(checker_texture));
+        add_texture(c->even.get());
+        add_texture(c->odd.get());
+    } else if (dynamic_cast<const noise_texture*>(t)) {
+        add("textures", "noise_texture", sizeof(noise_texture) + perlin::table_bytes());
+    } else if (auto img = dynamic_cast<const image_texture*>(t)) {
+        add("textures", "image_texture", sizeof(image_texture));
+        // Decoded mip levels live in the cache's backing file, once per image
+        int handle = img->cache_handle();
+        if (handle >= 0 && images.insert(handle).second) {
+            auto& cache = texture_cache::global();
+            size_t decoded = 0;
+            for (int level=0;level<cache.level_count(handle);level++)
+                decoded += static_cast<size_t>(cache.width(handle, level)) * cache.height(handle, level) * 3*sizeof(float);
+            add("textures", "decoded images (cache file)", decoded, 1, true);
+        }
+    } else if (auto prog = dynamic_cast<const texture_program*>(t)) {
+        add("textures", "texture_program", sizeof(texture_program) + vector_bytes(prog->code)
+            + vector_bytes(prog->constants) + vector_bytes(prog->leaves));
+        for (const auto& leaf : prog->leaves)
+            add_texture(leaf.get());
+    } else {
+        add("textures", "other", sizeof(texture));
+    }
+}
+
+size_t memory_report :: total() const {
+    size_t n = 0;
+    for (const auto& e : entries)
+        if (!e.file_backed)
+            n += e.bytes;
+    return n;
+}
+
+void memory_report :: print(std::ostream& out, const std::string& title) const {
+    out << title << ":\n";
+    auto kib = [](size_t bytes) { return static_cast<double>(bytes) / 1024; };
+    // Categories in the order they first appear
+    std::vector<std::string> categories;
+    for (const auto& e : entries)
+        if (std::find(categories.begin(), categories.end(), e.category) == categories.end())
+            categories.push_back(e.category);
+
+    for (const auto& category : categories) {
+        size_t sum = 0;
+        for (const auto& e : entries)
+            if (e.category == category && !e.file_backed)
+                sum += e.bytes;
+        out << "  " << std::left << std::setw(34) << category << std::right << std::fixed << std::setprecision(1)
+            << std::setw(12) << kib(sum) << " KiB\n";
+        for (const auto& e : entries)
+            if (e.category == category)
+                out << "    " << std::left << std::setw(32) << e.type << std::right << std::fixed << std::setprecision(1)
+                    << std::setw(12) << kib(e.bytes) << " KiB" << std::setw(10) << e.count
+                    << (e.file_backed ? "  (file-backed)" : "") << "\n";
+    }
+    out << "  " << std::left << std::setw(34) << "total" << std::right << std::fixed << std::setprecision(1)
+        << std::setw(12) << kib(total()) << " KiB\n";
+}
+
+bool memory_report :: write_json(const std::string& path) const {
+    std::ofstream out(path);
+    if (!out) {
+        std::cerr << "ERROR: Could not write '" << path << "'.\n";
+        return false;
+    }
+    out << "{\n  \"total_bytes\": " << total() << ",\n  \"entries\": [\n";
+    for (size_t i=0;i<entries.size();i++){
+        const auto& e = entries[i];
+        out << "    {\"category\": \"" << e.category << "\", \"type\": \"" << e.type << "\", \"bytes\": " << e.bytes
+            << ", \"count\": " << e.count << ", \"file_backed\": " << (e.file_backed ? "true" : "false") << "}"
+            << (i+1 < entries.size() ? ",\n" : "\n");
+    }
+    out << "  ]\n}\n";
+    return static_cast<bool>(out);
+}
+
+#endif
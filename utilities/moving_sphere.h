@@ -20,6 +20,9 @@ class moving_sphere : public hittable {
         virtual bool bounding_box(
             double _time0, double _time1, aabb& output_bounding_box) const override;
 
+        virtual bool motion_bounding_box(
+            double _time0, double _time1, aabb& box_start, aabb& box_end) const override;
+
         point3 center(double time) const;
 
     public:
@@ -35,6 +38,7 @@ point3 moving_sphere :: center(double time) const {
 }
 
 bool moving_sphere :: hit (const ray& r, double t_min, double t_max, hit_record& rec) const {
+    RT_STAT_INC(moving_sphere_tests);
     vec3 oc = r.origin() - center(r.time());
     auto a = r.direction().length_squared();
     auto half_b = dot(oc, r.direction());
@@ -56,7 +60,8 @@ bool moving_sphere :: hit (const ray& r, double t_min, double t_max, hit_record&
     rec.p = r.at(rec.t);
     auto outward_normal = (rec.p - center(r.time())) / radius;
     rec.set_face_normal(r, outward_normal);
-    rec.mat_ptr = mat_ptr;
+    rec.set_footprint(r, pi*radius);
+    rec.mat_ptr = mat_ptr.get();
 
     return true;
 }
@@ -75,4 +80,11 @@ bool moving_sphere :: bounding_box(double _time0, double _time1, aabb& output_bo
     return true;
 }
 
+bool moving_sphere :: motion_bounding_box(double _time0, double _time1, aabb& box_start, aabb& box_end) const {
+    auto r = point3(radius, radius, radius);
+    box_start = aabb(center(_time0) - r, center(_time0) + r);
+    box_end = aabb(center(_time1) - r, center(_time1) + r);
+    return true;
+}
+
 #endif
\ No newline at end of file
@@ -0,0 +1,231 @@
+#ifndef PATH_CAPTURE_H
+#define PATH_CAPTURE_H
+
+#include "general.h"
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Records every vertex of selected paths to a binary log for tools/pathstat.
+// Each render thread appends to its own buffer without locking; a buffer is
+// written out at a path boundary once it is full, so the vertices of one path
+// are always contiguous in the file.
+namespace path_capture_format {
+    enum event : uint8_t {
+        camera,         // ray leaves the camera
+        scatter,        // surface scatter
+        medium,         // scatter in the global medium
+        emit,           // hit a light, path ends
+        absorb,         // hit a surface that neither scatters nor emits
+        escape,         // left the scene, gets the background
+        max_depth,      // cut off at the depth limit
+        path_end,       // throughput holds the path's radiance
+        event_count
+    };
+
+    inline const char* event_name(int e) {
+        static const char* names[event_count] = {
+            "camera", "scatter", "medium", "emit", "absorb", "escape", "max_depth", "path_end"
+        };
+        return e >= 0 && e < event_count ? names[e] : "unknown";
+    }
+
+    // Header of a capture file, followed by path_vertex records
+    struct file_header {
+        char magic[8];      // "RTPATH1"
+        int32_t width;
+        int32_t height;
+    };
+
+    const char magic[8] = "RTPATH1";
+
+    struct path_vertex {
+        float position[3];
+        float throughput[3];    // arriving at the vertex, before its own attenuation
+        uint32_t pixel;         // y*width + x, top row first
+        uint32_t material;      // material::id, as in the material_id AOV
+        uint16_t sample;
+        uint8_t depth;          // vertex index along the path
+        uint8_t event;
+    };
+    static_assert(sizeof(path_vertex) == 36, "path_vertex is written as is");
+}
+
+class path_capture {
+    public:
+        typedef path_capture_format::path_vertex vertex;
+        typedef path_capture_format::event event;
+
+        // Flushed once a thread's buffer holds this many vertices
+        static const size_t buffer_vertices = 1 << 16;
+
+        path_capture() {}
+        ~path_capture() { close(); }
+
+        path_capture(const path_capture&) = delete;
+        path_capture& operator=(const path_capture&) = delete;
+
+        // Captures pixels in [x0, x1) x [y0, y1) (top row first), keeping each
+        // sample with probability sample_rate. Selection hashes the pixel and
+        // sample, so capturing does not change the rendered image.
+        bool open(const std::string& path, int width, int height,
+                  int x0, int y0, int x1, int y1, double sample_rate = 1.0);
+        bool close();
+
+        bool selected(int x, int y, int sample) const {
+            if (!file || x < x0 || x >= x1 || y < y0 || y >= y1)
+                return false;
+            if (sample_rate >= 1.0)
+                return true;
+            uint64_t h = (static_cast<uint64_t>(y)*image_width + x) * 0x9e3779b97f4a7c15ull + sample;
+            h ^= h >> 33;
+            h *= 0xff51afd7ed558ccdull;
+            h ^= h >> 33;
+            return (h >> 11) * (1.0 / 9007199254740992.0) < sample_rate;
+        }
+
+        // Starts recording on this thread; ray_color adds the vertices
+        void begin_path(int x, int y, int sample, const point3& origin);
+        void end_path(const color& radiance);
+
+        // Adds a vertex to the path being recorded on this thread, if any
+        static void record(event e, const point3& p, uint32_t material, const color& attenuation) {
+            if (auto* b = active())
+                b->add(e, p, material, attenuation);
+        }
+
+    private:
+        struct thread_buffer {
+            std::vector<vertex> vertices;
+            color throughput;
+            uint32_t pixel = 0;
+            uint16_t sample = 0;
+            uint8_t depth = 0;
+
+            void add(event e, const point3& p, uint32_t material, const color& attenuation) {
+                vertex v;
+                for (int c=0;c<3;c++){
+                    v.position[c] = static_cast<float>(p[c]);
+                    v.throughput[c] = static_cast<float>(throughput[c]);
+                }
+                v.pixel = pixel;
+                v.material = material;
+                v.sample = sample;
+                v.depth = depth < 255 ? depth++ : depth;
+                v.event = e;
+                vertices.push_back(v);
+                throughput = throughput * attenuation;
+            }
+        };
+
+        static thread_buffer*& active() {
+            thread_local thread_buffer* b = nullptr;
+            return b;
+        }
+
+        thread_buffer* buffer_for_this_thread();
+        void flush(thread_buffer& b);
+
+    private:
+        std::FILE* file = nullptr;
+        int image_width = 0;
+        int x0 = 0, y0 = 0, x1 = 0, y1 = 0;
+        double sample_rate = 1.0;
+
+        std::mutex m;
+        std::vector<std::unique_ptr<thread_buffer>> buffers;
+        uint64_t generation = 0;
+};
+
+bool path_capture :: open(const std::string& path, int width, int height,
+                          int _x0, int _y0, int _x1, int _y1, double _sample_rate) {
+    close();
+    file = std::fopen(path.c_str(), "wb");
+    if (!file) {
+        std::cerr << "ERROR: Could not write path capture '" << path << "'.\n";
+        return false;
+    }
+
+    path_capture_format::file_header header;
+    std::memcpy(header.magic, path_capture_format::magic, sizeof(header.magic));
+    header.width = width;
+    header.height = height;
+    std::fwrite(&header, sizeof(header), 1, file);
+
+    image_width = width;
+    x0 = _x0; y0 = _y0; x1 = _x1; y1 = _y1;
+    sample_rate = _sample_rate;
+
+    // Buffers cached by threads of an earlier capture are stale now
+    static std::atomic<uint64_t> next_generation{1};
+    generation = next_generation++;
+    return true;
+}
+
+// Call once the render threads are done
+bool path_capture :: close() {
+    if (!file)
+        return true;
+    for (auto& b : buffers)
+        flush(*b);
+    buffers.clear();
+    bool ok = std::ferror(file) == 0;
+    ok = std::fclose(file) == 0 && ok;
+    file = nullptr;
+    if (!ok)
+        std::cerr << "ERROR: Could not finish the path capture.\n";
+    return ok;
+}
+
+path_capture::thread_buffer* path_capture :: buffer_for_this_thread() {
+    thread_local thread_buffer* cached = nullptr;
+    thread_local uint64_t cached_generation = 0;
+    if (cached && cached_generation == generation)
+        return cached;
+
+    std::lock_guard<std::mutex> lock(m);
+    buffers.push_back(std::unique_ptr<thread_buffer>(new thread_buffer));
+    cached = buffers.back().get();
+    cached->vertices.reserve(buffer_vertices);
+    cached_generation = generation;
+    return cached;
+}
+
+void path_capture :: begin_path(int x, int y, int sample, const point3& origin) {
+    auto* b = buffer_for_this_thread();
+    b->pixel = static_cast<uint32_t>(y*image_width + x);
+    b->sample = static_cast<uint16_t>(sample < 65535 ? sample : 65535);
+    b->depth = 0;
+    b->throughput = color(1, 1, 1);
+    b->add(path_capture_format::camera, origin, 0, color(1, 1, 1));
+    active() = b;
+}
+
+void path_capture :: end_path(const color& radiance) {
+    auto* b = active();
+    if (!b)
+        return;
+    b->throughput = radiance;
+    b->add(path_capture_format::path_end, point3(0, 0, 0), 0, color(1, 1, 1));
+    active() = nullptr;
+
+    if (b->vertices.size() >= buffer_vertices) {
+        std::lock_guard<std::mutex> lock(m);
+        flush(*b);
+    }
+}
+
+void path_capture :: flush(thread_buffer& b) {
+    if (!b.vertices.empty())
+        std::fwrite(b.vertices.data(), sizeof(vertex), b.vertices.size(), file);
+    b.vertices.clear();
+}
+
+#endif
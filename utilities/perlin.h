@@ -3,13 +3,22 @@
 
 #include "general.h"
 
+// Gradient noise. Gradients are kept as separate x/y/z tables so that four
+// points (or four octaves of one point) can be evaluated together in f64x4
+// lanes; single points take a scalar path.
 class perlin{
 
     public:
         perlin(){
-            randvec = new vec3[point_count];
-            for (int i=0;i<point_count;i++)
-                randvec[i] = unit_vector(vec3 :: random(-1, 1));
+            grad_x = new double[point_count];
+            grad_y = new double[point_count];
+            grad_z = new double[point_count];
+            for (int i=0;i<point_count;i++){
+                auto g = unit_vector(vec3 :: random(-1, 1));
+                grad_x[i] = g.x();
+                grad_y[i] = g.y();
+                grad_z[i] = g.z();
+            }
             
             perm_x = perlin_generate_perm();
             perm_y = perlin_generate_perm();
@@ -17,63 +26,135 @@ class perlin{
         }
 
         ~perlin(){
-            delete[] randvec;
+            delete[] grad_x;
+            delete[] grad_y;
+            delete[] grad_z;
             delete[] perm_x;
             delete[] perm_y;
             delete[] perm_z;
         }
 
-        // double noise(const point3& p) const {
-        //     int i = static_cast<int>(4*p.x()) & 255;
-        //     int j = static_cast<int>(4*p.y()) & 255;
-        //     int k = static_cast<int>(4*p.z()) & 255;
-
-        //     return (randvec[perm_x[i] ^ perm_y[j] ^ perm_z[k]].length_squared());
-        // }
+        perlin(const perlin&) = delete;
+        perlin& operator=(const perlin&) = delete;
 
+        // Noise at one point. Same arithmetic as one lane of noise4, without
+        // paying for the other three lanes' gathers.
         double noise(const point3& p) const {
-            auto u = p.x() - floor(p.x());
-            auto v = p.y() - floor(p.y());
-            auto w = p.z() - floor(p.z());
+            auto fx = floor(p.x()), fy = floor(p.y()), fz = floor(p.z());
+            auto u = p.x() - fx, v = p.y() - fy, w = p.z() - fz;
+            int i = static_cast<int>(fx), j = static_cast<int>(fy), k = static_cast<int>(fz);
+
+            // Hermite smoothing of the fractional parts
+            auto uu = u*u*(3.0 - 2.0*u);
+            auto vv = v*v*(3.0 - 2.0*v);
+            auto ww = w*w*(3.0 - 2.0*w);
+
+            auto accum = 0.0;
+            for (int di=0;di<2;di++){
+                auto wx = di ? uu : 1.0 - uu;
+                auto ox = di ? u - 1.0 : u;
+                for (int dj=0;dj<2;dj++){
+                    auto wy = dj ? wx*vv : wx*(1.0 - vv);
+                    auto oy = dj ? v - 1.0 : v;
+                    for (int dk=0;dk<2;dk++){
+                        auto wz = dk ? wy*ww : wy*(1.0 - ww);
+                        auto oz = dk ? w - 1.0 : w;
+
+                        auto g = perm_x[(i+di) & 255] ^ perm_y[(j+dj) & 255] ^ perm_z[(k+dk) & 255];
+                        auto d = grad_x[g]*ox + grad_y[g]*oy + grad_z[g]*oz;
+                        accum = accum + wz*d;
+                    }
+                }
+            }
+
+            return accum;
+        }
 
-            int i = static_cast<int>(floor(p.x()));
-            int j = static_cast<int>(floor(p.y()));
-            int k = static_cast<int>(floor(p.z()));
+        // Noise at four points, one per lane. Only worth it when four points or
+        // octaves are evaluated together, as in turbulance.
+        f64x4 noise4(f64x4 x, f64x4 y, f64x4 z) const {
+            auto fx = vfloor(x), fy = vfloor(y), fz = vfloor(z);
+            auto u = x - fx, v = y - fy, w = z - fz;
+
+            alignas(32) double cx[4], cy[4], cz[4];
+            fx.store(cx);
+            fy.store(cy);
+            fz.store(cz);
+            int i[4], j[4], k[4];
+            for (int l=0;l<4;l++){
+                i[l] = static_cast<int>(cx[l]);
+                j[l] = static_cast<int>(cy[l]);
+                k[l] = static_cast<int>(cz[l]);
+            }
 
-            vec3 c[2][2][2];
+            // Hermite smoothing of the fractional parts
+            const f64x4 one(1.0), two(2.0), three(3.0);
+            auto uu = u*u*(three - two*u);
+            auto vv = v*v*(three - two*v);
+            auto ww = w*w*(three - two*w);
 
-            for (int di=0;di<2;i++){
+            f64x4 accum(0.0);
+            for (int di=0;di<2;di++){
+                auto wx = di ? uu : one - uu;
+                auto ox = di ? u - one : u;
                 for (int dj=0;dj<2;dj++){
+                    auto wy = dj ? wx*vv : wx*(one - vv);
+                    auto oy = dj ? v - one : v;
                     for (int dk=0;dk<2;dk++){
-                        c[di][dj][dk] = randvec[
-                            perm_x[(i+di) & 255] ^
-                            perm_y[(j+dj) & 255] ^
-                            perm_z[(k+dk) & 255]
-                        ];
+                        auto wz = dk ? wy*ww : wy*(one - ww);
+                        auto oz = dk ? w - one : w;
+
+                        // Gather the corner gradients for all four lanes
+                        alignas(32) double gx[4], gy[4], gz[4];
+                        for (int l=0;l<4;l++){
+                            auto g = perm_x[(i[l]+di) & 255] ^ perm_y[(j[l]+dj) & 255] ^ perm_z[(k[l]+dk) & 255];
+                            gx[l] = grad_x[g];
+                            gy[l] = grad_y[g];
+                            gz[l] = grad_z[g];
+                        }
+
+                        auto d = f64x4::load(gx)*ox + f64x4::load(gy)*oy + f64x4::load(gz)*oz;
+                        accum = accum + wz*d;
                     }
                 }
             }
 
-            return perlin_interpolation(c, u, v, w);
+            return accum;
         }
 
+        // Sum of depth octaves, each at twice the frequency and half the weight of
+        // the previous one. Octaves are evaluated four at a time.
         double turbulance(const point3& p, int depth = 7) const {
+            alignas(32) double out[4];
             auto sum = 0.0;
-            auto temp_p = p;
+            auto scale = 1.0;
             auto weight = 1.0;
 
-            for (int i=0;i<depth;i++){
-                sum += weight*noise(p);
-                weight *= 0.5;
-                temp_p *= 2;
+            for (int i=0;i<depth;i+=4){
+                alignas(32) double s[4], wgt[4];
+                for (int l=0;l<4;l++){
+                    s[l] = scale;
+                    wgt[l] = (i+l < depth) ? weight : 0.0;
+                    scale *= 2;
+                    weight *= 0.5;
+                }
+                auto sv = f64x4::load(s);
+                auto n = noise4(sv*f64x4(p.x()), sv*f64x4(p.y()), sv*f64x4(p.z()));
+                (n * f64x4::load(wgt)).store(out);
+                sum += (out[0] + out[1]) + (out[2] + out[3]);
             }
 
             return fabs(sum);
         }
 
+        // Heap bytes of the gradient and permutation tables
+        static size_t table_bytes() { return point_count * 3 * (sizeof(double) + sizeof(int)); }
+
     private:
         static const int point_count = 256;
-        vec3* randvec;
+        double* grad_x;
+        double* grad_y;
+        double* grad_z;
         int* perm_x;
         int* perm_y;
         int* perm_z;
@@ -98,25 +179,6 @@ class perlin{
             }
 
         }
-
-        static double perlin_interpolation(vec3 c[2][2][2], double u, double v, double w){
-            auto uu = u*u*(3-2*u);
-            auto vv = v*v*(3-2*v);
-            auto ww = w*w*(3-2*w);
-            auto accum = 0.0;
-
-            for (int i=0; i < 2; i++)
-                for (int j=0; j < 2; j++)
-                    for (int k=0; k < 2; k++) {
-                        vec3 weight_v(u-i, v-j, w-k);
-                        accum += (i*uu + (1-i)*(1-uu))
-                               * (j*vv + (1-j)*(1-vv))
-                               * (k*ww + (1-k)*(1-ww))
-                               * dot(c[i][j][k], weight_v);
-                    }
-
-            return accum;
-        }
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -15,6 +15,9 @@ class ray{
         ray(const point3& origin, const vec3& direction, double time = 0.0)
             : orig(origin), dir(direction), tm(time) {}
 
+        ray(const point3& origin, const vec3& direction, double time, double width, double spread)
+            : orig(origin), dir(direction), tm(time), cone_width(width), cone_spread(spread) {}
+
         vec3 direction() const { return dir; }
         point3 origin() const { return orig; }
         double time() const { return tm; }
@@ -23,10 +26,20 @@ class ray{
             return orig+t*dir;
         }
 
+        // Width of the ray cone (in world units) at parameter t
+        double footprint(double t) const {
+            return cone_width + cone_spread * t * dir.length();
+        }
+
     public:
         point3 orig;
         vec3 dir;
         double tm;
+
+        // Ray cone: a compact form of ray differentials. The ray stands for a cone
+        // of width cone_width at its origin that grows by cone_spread per unit distance.
+        double cone_width = 0;
+        double cone_spread = 0;
 };
 
 #endif
\ No newline at end of file
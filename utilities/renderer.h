@@ -0,0 +1,238 @@
+#ifndef RENDERER_H
+#define RENDERER_H
+
+#include "general.h"
+
+#include "aov.h"
+#include "camera.h"
+#include "framebuffer.h"
+#include "global_medium.h"
+#include "heatmap.h"
+#include "hittable.h"
+#include "material.h"
+#include "path_capture.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <vector>
+
+const int max_depth = 50;
+
+// first_hit, if given, receives the features of the first intersection, and
+// path_length is incremented for every ray of the path. Vertices go to the
+// path capture when this thread is recording a path.
+color ray_color(
+    const ray& r, const color& background, const hittable& world, const global_medium* fog, int depth,
+    aov_sample* first_hit = nullptr, int* path_length = nullptr
+){
+    hit_record rec;
+
+    // If max depth is reached no more light is scattered
+    if (depth <= 0) {
+        path_capture::record(path_capture_format::max_depth, r.origin(), 0, color(0,0,0));
+        return color(0,0,0);
+    }
+
+    RT_STAT_RAY(max_depth - depth);
+    if (path_length)
+        ++*path_length;
+
+    bool hit_surface = world.hit(r, 0.001, infinity, rec);
+
+    // Free-flight sampling through the global medium, up to the surface hit
+    bool hit_medium = fog && fog->sample(r, 0.001, hit_surface ? rec.t : infinity, rec);
+
+    // If ray hits nothing we return the background color
+    if (!hit_surface && !hit_medium){
+        if (first_hit)
+            first_hit->albedo = background;
+        path_capture::record(path_capture_format::escape, r.origin(), 0, color(0,0,0));
+        return background;
+    }
+
+    ray scattered;
+    color attenuation;
+    color emmited = rec.mat_ptr->emitted(rec.u, rec.v, rec.p);
+    bool scatters = rec.mat_ptr->scatter(r, rec, attenuation, scattered);
+
+    if (first_hit) {
+        first_hit->hit = true;
+        first_hit->albedo = scatters ? attenuation : vmin(emmited, color(1,1,1));
+        first_hit->normal = rec.normal;
+        first_hit->depth = rec.t * r.direction().length();
+        first_hit->object = rec.object ? rec.object->id : 0;
+        first_hit->material = rec.mat_ptr->id;
+    }
+
+    path_capture::record(
+        !scatters ? (emmited.near_zero() ? path_capture_format::absorb : path_capture_format::emit)
+                  : (hit_medium ? path_capture_format::medium : path_capture_format::scatter),
+        rec.p, rec.mat_ptr->id, scatters ? attenuation : color(0,0,0));
+
+    if (!scatters)
+        return emmited;
+
+    return emmited + attenuation * ray_color(scattered, background, world, fog, depth-1, nullptr, path_length);
+}
+
+struct render_settings {
+    int samples_per_pixel = 200;
+    unsigned thread_count = 0;      // 0 for one per hardware thread
+    uint64_t seed = 1;
+};
+
+// Renders an image one row per task on a thread pool. Every pixel reseeds the
+// thread's generator from the seed and its index, so the image is the same
+// for any thread count or row order.
+class renderer {
+    public:
+        renderer(
+            const camera& _cam, const hittable& _world, const color& _background, const global_medium* _fog,
+            int w, int h, const render_settings& _settings
+        ) : cam(_cam), world(_world), background(_background), fog(_fog), width(w), height(h), settings(_settings) {}
+
+        // on_row(y, rgb) receives each finished row, y counted from the top.
+        // Calls come from the workers but never overlap.
+        framebuffer render(const std::function<void(int, const float*)>& on_row = nullptr);
+
+        // Camera and scattered rays traced by the last render()
+        uint64_t rays_traced() const { return rays; }
+
+    public:
+        // Filled during render() when set
+        aov_buffers* aovs = nullptr;
+        heatmap_buffers* heat = nullptr;
+        path_capture* capture = nullptr;
+
+        // When set, receives the finished rows every progress_rows rows, in a
+        // copy where the other pixels have no samples, so a preview can be
+        // denoised mid-render. Needs aovs. Runs on the worker that finished
+        // the row, outside the row lock; a preview that comes due while the
+        // last one is still running is dropped.
+        std::function<void(const framebuffer&, const aov_buffers&)> on_progress;
+        int progress_rows = 0;
+
+    private:
+        void render_row(int y, framebuffer& image, std::vector<float>& rgb, uint64_t& row_rays);
+
+    private:
+        const camera& cam;
+        const hittable& world;
+        color background;
+        const global_medium* fog;
+        int width, height;
+        render_settings settings;
+
+        std::atomic<uint64_t> rays{0};
+        std::mutex row_mutex;
+        std::mutex progress_mutex;      // held while on_progress runs
+};
+
+void renderer :: render_row(int y, framebuffer& image, std::vector<float>& rgb, uint64_t& row_rays) {
+    // Camera space has j going up
+    const int j = height - 1 - y;
+    const int spp = settings.samples_per_pixel;
+
+    for (int i=0;i<width;i++){
+        const int index = y*width + i;
+        seed_random(settings.seed * 0x9e3779b97f4a7c15ull + static_cast<uint64_t>(index));
+
+        auto start_time = heat ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point();
+        auto start_visits = heat ? heatmap_buffers::bvh_visits_so_far() : 0.0;
+        int path_length = 0;
+
+        color pixel_color(0, 0, 0);
+        aov_buffers::pixel features;
+        for (int s = 0; s < spp; ++s) {
+            auto u = (i + random_double()) / (width-1);
+            auto v = (j + random_double()) / (height-1);
+            ray r = cam.get_ray(u, v);
+            aov_sample first_hit;
+            bool recording = capture && capture->selected(i, y, s);
+            if (recording)
+                capture->begin_path(i, y, s, r.origin());
+            auto sample_color = ray_color(r, background, world, fog, max_depth, aovs ? &first_hit : nullptr, &path_length);
+            if (recording)
+                capture->end_path(sample_color);
+            pixel_color += sample_color;
+            if (aovs)
+                features.add(first_hit, sample_color);
+        }
+        pixel_color /= spp;
+        row_rays += path_length;
+
+        image.set(i, y, pixel_color);
+        for (int c=0;c<3;c++)
+            rgb[3*i + c] = static_cast<float>(pixel_color[c]);
+
+        if (aovs)
+            aovs->store(index, features);
+        if (heat) {
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start_time;
+            heat->store(index, elapsed.count(),
+                (heatmap_buffers::bvh_visits_so_far() - start_visits) / spp,
+                static_cast<double>(path_length) / spp);
+        }
+    }
+}
+
+framebuffer renderer :: render(const std::function<void(int, const float*)>& on_row) {
+    framebuffer image(width, height);
+    rays = 0;
+
+    // Finished rows are copied out under the row lock, so the preview never
+    // reads a row that is still being written
+    const bool progress = on_progress && aovs && progress_rows > 0;
+    framebuffer preview(progress ? width : 0, progress ? height : 0);
+    aov_buffers preview_aovs(progress ? width : 0, progress ? height : 0);
+    int rows_done = 0;
+
+    thread_pool pool(settings.thread_count);
+    std::vector<std::future<void>> rows;
+    rows.reserve(height);
+    for (int y=0;y<height;y++)
+        rows.push_back(pool.submit([this, y, progress, &image, &on_row, &preview, &preview_aovs, &rows_done]{
+            std::vector<float> rgb(static_cast<size_t>(width)*3);
+            uint64_t row_rays = 0;
+            render_row(y, image, rgb, row_rays);
+            rays += row_rays;
+            bool preview_due = false;
+            if (on_row || progress) {
+                std::lock_guard<std::mutex> lock(row_mutex);
+                if (on_row)
+                    on_row(y, rgb.data());
+                if (progress) {
+                    std::copy(rgb.begin(), rgb.end(), preview.row(y));
+                    preview_aovs.copy_row(*aovs, y);
+                    preview_due = ++rows_done % progress_rows == 0 && rows_done < height;
+                }
+            }
+
+            // Only the snapshot is taken under the row lock, so other rows keep
+            // reporting while the preview is processed
+            if (preview_due) {
+                std::unique_lock<std::mutex> busy(progress_mutex, std::try_to_lock);
+                if (!busy.owns_lock())
+                    return;
+                framebuffer snapshot;
+                aov_buffers snapshot_aovs(0, 0);
+                {
+                    std::lock_guard<std::mutex> lock(row_mutex);
+                    snapshot = preview;
+                    snapshot_aovs = preview_aovs;
+                }
+                on_progress(snapshot, snapshot_aovs);
+            }
+        }));
+    for (auto& r : rows)
+        r.get();
+
+    return image;
+}
+
+#endif
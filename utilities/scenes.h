@@ -0,0 +1,471 @@
+#ifndef SCENES_H
+#define SCENES_H
+
+#include "general.h"
+
+#include "hittable_list.h"
+#include "sphere.h"
+#include "material.h"
+#include "moving_sphere.h"
+#include "texture.h"
+#include "texture_registry.h"
+#include "aarect.h"
+#include "box.h"
+#include "constant_medium.h"
+#include "bvh.h"
+#include "transform.h"
+#include "global_medium.h"
+#include "heterogeneous_medium.h"
+#include "sparse_volume.h"
+#include "texture_bake.h"
+
+#include <cstring>
+#include <filesystem>
+#include <string>
+
+// Procedural texture for a sphere. With a bake directory it is baked over the
+// sphere once, saved there as name.rtbake and read back on later runs.
+shared_ptr<texture> sphere_texture(
+    shared_ptr<texture> tex, const point3& center, double radius, const char* bake_dir, const char* name
+) {
+    if (!bake_dir)
+        return tex;
+    std::error_code ignored;
+    std::filesystem::create_directories(bake_dir, ignored);
+    auto path = std::string(bake_dir) + "/" + name + ".rtbake";
+    return bake_texture(tex, sphere(center, radius, nullptr), 1024, 512, path.c_str());
+}
+
+hittable_list random_scene() {
+    hittable_list world;
+
+    auto even_checker = make_scene_shared<checker_texture>(color(0.5, 0.5, 0.5), color(0.4, 0.8, 0.9), 100);
+    auto odd_checker = make_scene_shared<checker_texture>(color(0.2, 0.3, 0.1), color(0.9, 0.9, 0.9), 1);
+    auto checker = make_scene_shared<checker_texture>(even_checker, odd_checker);
+    world.add(make_scene_shared<sphere>(point3(0,-1000,0), 1000, make_scene_shared<lambertian>(checker)));
+
+    for (int a = -11; a < 11; a++) {
+        for (int b = -11; b < 11; b++) {
+            auto choose_mat = random_double();
+            point3 center(a + 0.9*random_double(), 0.2, b + 0.9*random_double());
+
+            if ((center - point3(4, 0.2, 0)).length() > 0.9) {
+                shared_ptr<material> sphere_material;
+
+                if (choose_mat < 0.8) {
+                    // diffuse
+                    auto albedo = color::random() * color::random();
+                    sphere_material = make_scene_shared<lambertian>(albedo);
+                    auto center2 = center + point3(0, random_double(0, 0.5), 0);
+                    world.add(make_scene_shared<moving_sphere>(center, center2, 0.0, 1.0, 0.2, sphere_material));
+                } else if (choose_mat < 0.95) {
+                    // metal
+                    auto albedo = color::random(0.5, 1);
+                    auto fuzz = random_double(0, 0.5);
+                    sphere_material = make_scene_shared<metal>(albedo, fuzz);
+                    world.add(make_scene_shared<sphere>(center, 0.2, sphere_material));
+                } else {
+                    // glass
+                    sphere_material = make_scene_shared<dielectric>(1.5);
+                    world.add(make_scene_shared<sphere>(center, 0.2, sphere_material));
+                }
+            }
+        }
+    }
+
+    auto material1 = make_scene_shared<dielectric>(1.5);
+    world.add(make_scene_shared<sphere>(point3(0, 1, 0), 1.0, material1));
+
+    auto material2 = make_scene_shared<lambertian>(color(0.4, 0.2, 0.1));
+    world.add(make_scene_shared<sphere>(point3(-4, 1, 0), 1.0, material2));
+
+    auto material3 = make_scene_shared<metal>(color(0.7, 0.6, 0.5), 0.0);
+    world.add(make_scene_shared<sphere>(point3(4, 1, 0), 1.0, material3));
+
+    return world;
+}
+
+hittable_list two_spheres(const char* bake_dir = nullptr) {
+    hittable_list objects;
+
+    // auto checker = make_scene_shared<checker_texture>(color(0.2, 0.3, 0.1), color(0.9, 0.9, 0.9));
+    auto even_checker = make_scene_shared<checker_texture>(color(0.5, 0.5, 0.5), color(0.4, 0.8, 0.1), 100);
+    auto odd_checker = make_scene_shared<checker_texture>(color(0.2, 0.3, 0.1), color(0.4, 0.4, 0.8), 20);
+    auto checker = make_scene_shared<checker_texture>(even_checker, odd_checker);
+
+    auto bottom = sphere_texture(checker, point3(0,-2, 0), 2, bake_dir, "two_spheres_bottom");
+    auto top = sphere_texture(checker, point3(0, 2, 0), 2, bake_dir, "two_spheres_top");
+    objects.add(make_scene_shared<sphere>(point3(0,-2, 0), 2, make_scene_shared<lambertian>(bottom)));
+    objects.add(make_scene_shared<sphere>(point3(0, 2, 0), 2, make_scene_shared<lambertian>(top)));
+
+    return objects;
+}
+
+hittable_list two_perlin_spheres(const char* bake_dir = nullptr) {
+    hittable_list objects;
+
+    // The ground is far too large to bake at any sensible resolution
+    auto perlin_texture = make_scene_shared<noise_texture>(4);
+    auto small = sphere_texture(perlin_texture, point3(0, 2, 0), 2, bake_dir, "two_perlin_spheres");
+    objects.add(make_scene_shared<sphere>(point3(0,-1000,0), 1000, make_scene_shared<lambertian>(perlin_texture)));
+    objects.add(make_scene_shared<sphere>(point3(0, 2, 0), 2, make_scene_shared<lambertian>(small)));
+
+    return objects;
+}
+
+hittable_list image_textures() {
+    hittable_list objects;
+    auto _texture = texture_registry::global().get("texture images/Renne (1).png");
+    auto _surface = make_scene_shared<lambertian>(_texture);
+    auto _texture1 = texture_registry::global().get("texture images/Beautiful Mona.jpg");
+    auto _surface1 = make_scene_shared<lambertian>(_texture1);
+    auto light_source = make_scene_shared<diffuse_light>(color(4, 4, 4));
+    objects.add(make_scene_shared<sphere>(point3(0, 0, -2), 2, _surface1));
+    objects.add(make_scene_shared<sphere>(point3(0, 0, 2), 2, _surface));
+    objects.add(make_scene_shared<sphere>(point3(0, 3, 0), 5, light_source));
+    return objects;
+}
+
+hittable_list simple_light() {
+    hittable_list objects;
+
+    // auto pertext = make_scene_shared<noise_texture>(4);
+    // objects.add(make_scene_shared<sphere>(point3(0,-1000,0), 1000, make_scene_shared<lambertian>(pertext)));
+    // objects.add(make_scene_shared<sphere>(point3(0,2,0), 2, make_scene_shared<lambertian>(pertext)));
+
+    auto _texture = texture_registry::global().get("texture images/Renne (1).png");
+    auto _texture1 = texture_registry::global().get("texture images/Beautiful Mona.jpg");
+    auto difflight = make_scene_shared<diffuse_light>(color(4,4,4));
+    auto _checker = make_scene_shared<checker_texture>(color(0, 0, 0), color(1, 1, 1));
+    auto _floor = make_scene_shared<lambertian>(_checker);
+    auto _surface = make_scene_shared<lambertian>(_texture);
+    auto _surface1 = make_scene_shared<lambertian>(_texture1);
+
+    objects.add(make_scene_shared<sphere>(point3(0, 6, 0), 1, difflight));
+    objects.add(make_scene_shared<sphere>(point3(0, -1000, 0), 1000, _floor));
+    objects.add(make_scene_shared<sphere>(point3(0, 2, -3), 2, _surface1));
+    objects.add(make_scene_shared<sphere>(point3(0, 2, 3), 2, _surface));
+
+    objects.add(make_scene_shared<xy_rect>(2, 5, 1, 3, 5, difflight));
+    objects.add(make_scene_shared<xy_rect>(2, 4, 1, 3, -5, difflight));
+    // objects.add(make_scene_shared<xy_rect>(1, 4, 1, 3, -1.5, difflight));
+    objects.add(make_scene_shared<xy_rect>(1, 4, 1, 3, 0.5, difflight));
+
+
+    return objects;
+}
+
+hittable_list cornell_box() {
+    hittable_list objects;
+
+    auto red   = make_scene_shared<lambertian>(color(.65, .05, .05));
+    auto white = make_scene_shared<lambertian>(color(.73, .73, .73));
+    auto green = make_scene_shared<lambertian>(color(.12, .45, .15));
+    auto light = make_scene_shared<diffuse_light>(color(15, 15, 15));
+
+    objects.add(make_scene_shared<yz_rect>(0, 555, 0, 555, 555, green));
+    objects.add(make_scene_shared<yz_rect>(0, 555, 0, 555, 0, red));
+    objects.add(make_scene_shared<xz_rect>(213, 343, 227, 332, 554, light));
+    objects.add(make_scene_shared<xz_rect>(0, 555, 0, 555, 0, white));
+    objects.add(make_scene_shared<xz_rect>(0, 555, 0, 555, 555, white));
+    objects.add(make_scene_shared<xy_rect>(0, 555, 0, 555, 555, white));
+    objects.add(make_scene_shared<box>(point3(130, 0, 65), point3(295, 165, 230), white));
+    objects.add(make_scene_shared<box>(point3(265, 0, 295), point3(430, 330, 460), white));
+
+    shared_ptr<hittable> box1 = make_scene_shared<box>(point3(0, 0, 0), point3(165, 330, 165), white);
+    box1 = make_scene_shared<rotate_y>(box1, 15);
+    box1 = make_scene_shared<translate>(box1, vec3(265,0,295));
+    objects.add(box1);
+
+    shared_ptr<hittable> box2 = make_scene_shared<box>(point3(0,0,0), point3(165,165,165), white);
+    box2 = make_scene_shared<rotate_y>(box2, -18);
+    box2 = make_scene_shared<translate>(box2, vec3(130,0,65));
+    objects.add(box2);
+
+    return objects;
+}
+
+hittable_list cornell_smoke() {
+    hittable_list objects;
+
+    auto red   = make_scene_shared<lambertian>(color(.65, .05, .05));
+    auto white = make_scene_shared<lambertian>(color(.73, .73, .73));
+    auto green = make_scene_shared<lambertian>(color(.12, .45, .15));
+    auto light = make_scene_shared<diffuse_light>(color(7, 7, 7));
+
+    objects.add(make_scene_shared<yz_rect>(0, 555, 0, 555, 555, green));
+    objects.add(make_scene_shared<yz_rect>(0, 555, 0, 555, 0, red));
+    objects.add(make_scene_shared<xz_rect>(113, 443, 127, 432, 554, light));
+    objects.add(make_scene_shared<xz_rect>(0, 555, 0, 555, 555, white));
+    objects.add(make_scene_shared<xz_rect>(0, 555, 0, 555, 0, white));
+    objects.add(make_scene_shared<xy_rect>(0, 555, 0, 555, 555, white));
+
+    shared_ptr<hittable> box1 = make_scene_shared<box>(point3(0,0,0), point3(165,330,165), white);
+    box1 = make_scene_shared<rotate_y>(box1, 15);
+    box1 = make_scene_shared<translate>(box1, vec3(265,0,295));
+
+    shared_ptr<hittable> box2 = make_scene_shared<box>(point3(0,0,0), point3(165,165,165), white);
+    box2 = make_scene_shared<rotate_y>(box2, -18);
+    box2 = make_scene_shared<translate>(box2, vec3(130,0,65));
+
+    objects.add(make_scene_shared<constant_medium>(box1, 0.01, color(0,0,0)));
+    objects.add(make_scene_shared<constant_medium>(box2, 0.01, color(1,1,1)));
+
+    return objects;
+}
+
+// With sparse_path set, the cloud is written as a sparse brick volume and
+// memory-mapped back instead of being kept as a dense grid
+hittable_list cornell_cloud(const char* sparse_path = nullptr) {
+    hittable_list objects;
+
+    auto red   = make_scene_shared<lambertian>(color(.65, .05, .05));
+    auto white = make_scene_shared<lambertian>(color(.73, .73, .73));
+    auto green = make_scene_shared<lambertian>(color(.12, .45, .15));
+    auto light = make_scene_shared<diffuse_light>(color(7, 7, 7));
+
+    objects.add(make_scene_shared<yz_rect>(0, 555, 0, 555, 555, green));
+    objects.add(make_scene_shared<yz_rect>(0, 555, 0, 555, 0, red));
+    objects.add(make_scene_shared<xz_rect>(113, 443, 127, 432, 554, light));
+    objects.add(make_scene_shared<xz_rect>(0, 555, 0, 555, 555, white));
+    objects.add(make_scene_shared<xz_rect>(0, 555, 0, 555, 0, white));
+    objects.add(make_scene_shared<xy_rect>(0, 555, 0, 555, 555, white));
+
+    // Cloud made of overlapping gaussian puffs, voxelized into a dense grid
+    std::vector<point3> puffs;
+    for (int i = 0; i < 12; i++)
+        puffs.push_back(point3(random_double(180, 380), random_double(220, 340), random_double(180, 380)));
+
+    aabb bounds(point3(100, 140, 100), point3(460, 420, 460));
+    auto puff_density = [&puffs](const point3& p) {
+        double d = 0;
+        for (const auto& c : puffs)
+            d += exp(-(p - c).length_squared() / (2*45.0*45.0));
+        return d > 0.05 ? d : 0.0;
+    };
+
+    shared_ptr<density_field> cloud;
+    if (sparse_path) {
+        sparse_volume::write(sparse_path, bounds, 96, 72, 96, puff_density);
+        auto volume = make_scene_shared<sparse_volume>(sparse_path);
+        if (volume->is_open())
+            cloud = volume;
+    }
+    if (!cloud)
+        cloud = dense_grid::from_function(bounds, 96, 72, 96, puff_density);
+
+    objects.add(make_scene_shared<heterogeneous_medium>(cloud, 0.05, color(1, 1, 1)));
+
+    return objects;
+}
+
+hittable_list final_scene() {
+    hittable_list boxes1;
+    auto ground = make_scene_shared<lambertian>(color(0.48, 0.83, 0.53));
+
+    const int boxes_per_side = 20;
+    for (int i = 0; i < boxes_per_side; i++) {
+        for (int j = 0; j < boxes_per_side; j++) {
+            auto w = 100.0;
+            auto x0 = -1000.0 + i*w;
+            auto z0 = -1000.0 + j*w;
+            auto y0 = 0.0;
+            auto x1 = x0 + w;
+            auto y1 = random_double(1,101);
+            auto z1 = z0 + w;
+
+            boxes1.add(make_scene_shared<box>(point3(x0,y0,z0), point3(x1,y1,z1), ground));
+        }
+    }
+
+    hittable_list objects;
+
+    objects.add(make_scene_shared<bvh_node>(boxes1, 0, 1));
+
+    auto light = make_scene_shared<diffuse_light>(color(7, 7, 7));
+    objects.add(make_scene_shared<xz_rect>(123, 423, 147, 412, 554, light));
+
+    auto center1 = point3(400, 400, 200);
+    auto center2 = center1 + vec3(30,0,0);
+    auto moving_sphere_material = make_scene_shared<lambertian>(color(0.7, 0.3, 0.1));
+    objects.add(make_scene_shared<moving_sphere>(center1, center2, 0, 1, 50, moving_sphere_material));
+
+    objects.add(make_scene_shared<sphere>(point3(260, 150, 45), 50, make_scene_shared<dielectric>(1.5)));
+    objects.add(make_scene_shared<sphere>(
+        point3(0, 150, 145), 50, make_scene_shared<metal>(color(0.8, 0.8, 0.9), 1.0)
+    ));
+
+    auto boundary = make_scene_shared<sphere>(point3(360,150,145), 70, make_scene_shared<dielectric>(1.5));
+    objects.add(boundary);
+    objects.add(make_scene_shared<constant_medium>(boundary, 0.2, color(0.2, 0.4, 0.9)));
+    // The thin atmosphere around the scene is a global_medium, set up in main()
+
+    auto emat = make_scene_shared<lambertian>(texture_registry::global().get("texture images/Beautiful Mona.jpg"));
+    objects.add(make_scene_shared<sphere>(point3(400,200,400), 100, emat));
+    // auto pertext = make_scene_shared<noise_texture>(0.1);
+    // objects.add(make_scene_shared<sphere>(point3(220,280,300), 80, make_scene_shared<lambertian>(pertext)));
+
+    hittable_list boxes2;
+    auto white = make_scene_shared<lambertian>(color(.73, .73, .73));
+    int ns = 1000;
+    for (int j = 0; j < ns; j++) {
+        boxes2.add(make_scene_shared<sphere>(point3::random(0,165), 10, white));
+    }
+
+    objects.add(make_scene_shared<translate>(
+        make_scene_shared<rotate_y>(
+            make_scene_shared<bvh_node>(boxes2, 0.0, 1.0), 15),
+            vec3(-100,270,395)
+        )
+    );
+
+    return objects;
+}
+
+// A scene with the camera, background and render size it is meant for
+struct scene_setup {
+    hittable_list world;
+    point3 lookfrom;
+    point3 lookat;
+    double vfov = 40.0;
+    double aperture = 0.0;
+    double aspect_ratio = 16.0/9.0;
+    int image_width = 800;
+    int samples_per_pixel = 200;
+    color background;
+    shared_ptr<global_medium> fog;
+};
+
+// Builds scene id; ids without a scene of their own give final_scene. With a
+// bake directory, scenes that support it bake their procedural textures.
+scene_setup select_scene(int id, const char* bake_dir = nullptr) {
+    scene_setup s;
+    material::reset_ids();
+
+    switch (id) {
+        // Random scene
+        case 1:
+            s.world = random_scene();
+            s.lookfrom = point3(13,2,3);
+            s.background = color(0.7, 0.8, 1.0);
+            s.lookat = point3(0,0,0);
+            s.vfov = 20.0;
+            s.aperture = 0.1;
+            break;
+
+        // Scene with two spheres
+        case 2:
+            s.world = two_spheres(bake_dir);
+            s.lookfrom = point3(13,2,3);
+            s.background = color(0.7, 0.8, 1.0);
+            s.lookat = point3(0,0,0);
+            s.vfov = 20.0;
+            break;
+
+        // Scene with two perlin texture spheres
+        case 3:
+            s.world = two_perlin_spheres(bake_dir);
+            s.lookfrom = point3(13,2,3);
+            s.background = color(0.7, 0.8, 1.0);
+            s.lookat = point3(0,0,0);
+            s.vfov = 20.0;
+            break;
+
+        // Scene with image textures applied onto spheres
+        case 4:
+            s.world = image_textures();
+            s.lookfrom = point3(13,2,3);
+            s.background = color(0.7, 0.8, 1.0);
+            s.lookat = point3(0,0,0);
+            s.vfov = 20.0;
+            break;
+        
+        // Scene with light sources
+        case 5:
+            s.world = simple_light();
+            s.samples_per_pixel = 400;
+            s.background = color(0,0,0);
+            s.lookfrom = point3(26,3,6);
+            s.lookat = point3(0,2,0);
+            s.vfov = 20.0;
+            break;
+
+        case 6:
+            s.world = cornell_box();
+            s.aspect_ratio = 1.0;
+            s.image_width = 600;
+            s.samples_per_pixel = 200;
+            s.background = color(0,0,0);
+            s.lookfrom = point3(278, 278, -800);
+            s.lookat = point3(278, 278, 0);
+            s.vfov = 40.0;
+            break;
+
+        case 7:
+            s.world = cornell_smoke();
+            s.aspect_ratio = 1.0;
+            s.image_width = 600;
+            s.samples_per_pixel = 200;
+            s.lookfrom = point3(278, 278, -800);
+            s.lookat = point3(278, 278, 0);
+            s.vfov = 40.0;
+            break;
+        
+        case 9:
+            s.world = cornell_cloud();
+            s.aspect_ratio = 1.0;
+            s.image_width = 600;
+            s.samples_per_pixel = 200;
+            s.lookfrom = point3(278, 278, -800);
+            s.lookat = point3(278, 278, 0);
+            s.vfov = 40.0;
+            break;
+
+        case 10:
+            s.world = cornell_cloud("cloud.rtvol");
+            s.aspect_ratio = 1.0;
+            s.image_width = 600;
+            s.samples_per_pixel = 200;
+            s.lookfrom = point3(278, 278, -800);
+            s.lookat = point3(278, 278, 0);
+            s.vfov = 40.0;
+            break;
+
+        default:
+        case 8:
+            s.world = final_scene();
+            // s.aspect_ratio = 1.0;
+            s.image_width = 800;
+            s.samples_per_pixel = 200;
+            s.background = color(0,0,0);
+            s.fog = make_scene_shared<global_medium>(.0001, color(1,1,1), point3(0, 0, 0), 5000);
+            s.lookfrom = point3(478, 278, -600);
+            s.lookat = point3(278, 278, 0);
+            s.vfov = 40.0;
+            break;
+    }
+
+    return s;
+}
+
+// Ids of the scenes that can be selected by name
+struct named_scene {
+    const char* name;
+    int id;
+};
+
+const named_scene scene_names[] = {
+    {"random_scene", 1}, {"two_spheres", 2}, {"two_perlin_spheres", 3}, {"image_textures", 4},
+    {"simple_light", 5}, {"cornell_box", 6}, {"cornell_smoke", 7}, {"final_scene", 8},
+    {"cornell_cloud", 9}
+};
+
+// -1 for an unknown name
+inline int scene_id(const std::string& name) {
+    for (const auto& s : scene_names)
+        if (name == s.name)
+            return s.id;
+    return -1;
+}
+
+#endif
@@ -0,0 +1,180 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+// Thin wrapper over four packed doubles. Uses AVX when the compiler targets it,
+// falls back to a pair of SSE2 registers, and finally to plain scalar code.
+
+#if defined(__AVX__)
+    #include <immintrin.h>
+    #define RT_SIMD_AVX 1
+#elif defined(__SSE2__) || defined(_M_X64)
+    #include <emmintrin.h>
+    #define RT_SIMD_SSE2 1
+#endif
+
+#include <cmath>
+
+struct f64x4 {
+
+#if defined(RT_SIMD_AVX)
+    __m256d v;
+
+    f64x4() {}
+    f64x4(__m256d x) : v(x) {}
+    explicit f64x4(double s) : v(_mm256_set1_pd(s)) {}
+    f64x4(double a, double b, double c, double d) : v(_mm256_setr_pd(a, b, c, d)) {}
+
+    // p must be 32-byte aligned
+    static f64x4 load(const double* p) { return _mm256_load_pd(p); }
+    void store(double* p) const { _mm256_store_pd(p, v); }
+
+    friend f64x4 operator+(f64x4 a, f64x4 b) { return _mm256_add_pd(a.v, b.v); }
+    friend f64x4 operator-(f64x4 a, f64x4 b) { return _mm256_sub_pd(a.v, b.v); }
+    friend f64x4 operator*(f64x4 a, f64x4 b) { return _mm256_mul_pd(a.v, b.v); }
+    friend f64x4 operator/(f64x4 a, f64x4 b) { return _mm256_div_pd(a.v, b.v); }
+    friend f64x4 vmin(f64x4 a, f64x4 b) { return _mm256_min_pd(a.v, b.v); }
+    friend f64x4 vmax(f64x4 a, f64x4 b) { return _mm256_max_pd(a.v, b.v); }
+    friend f64x4 vsqrt(f64x4 a) { return _mm256_sqrt_pd(a.v); }
+    friend f64x4 vfloor(f64x4 a) { return _mm256_floor_pd(a.v); }
+
+    // Lanes where a or b is NaN take if_nan, the others otherwise
+    friend f64x4 vnan_select(f64x4 a, f64x4 b, f64x4 if_nan, f64x4 otherwise) {
+        return _mm256_blendv_pd(otherwise.v, if_nan.v, _mm256_cmp_pd(a.v, b.v, _CMP_UNORD_Q));
+    }
+
+    f64x4 operator-() const { return _mm256_xor_pd(v, _mm256_set1_pd(-0.0)); }
+
+    // Sum of all four lanes
+    double hsum() const {
+        __m128d lo = _mm256_castpd256_pd128(v);
+        __m128d hi = _mm256_extractf128_pd(v, 1);
+        lo = _mm_add_pd(lo, hi);
+        return _mm_cvtsd_f64(_mm_add_sd(lo, _mm_unpackhi_pd(lo, lo)));
+    }
+
+    // Sum of lanes 0-2, ignoring lane 3. Same order as hsum with a zero lane 3.
+    double hsum3() const {
+        __m128d lo = _mm256_castpd256_pd128(v);
+        lo = _mm_add_sd(lo, _mm256_extractf128_pd(v, 1));
+        return _mm_cvtsd_f64(_mm_add_sd(lo, _mm_unpackhi_pd(lo, lo)));
+    }
+
+    // Lane rotations (x,y,z,w) -> (y,z,x,w) and (z,x,y,w), used by cross products
+    f64x4 yzxw() const {
+    #if defined(__AVX2__)
+        return _mm256_permute4x64_pd(v, _MM_SHUFFLE(3, 0, 2, 1));
+    #else
+        alignas(32) double e[4];
+        store(e);
+        return f64x4(e[1], e[2], e[0], e[3]);
+    #endif
+    }
+
+    f64x4 zxyw() const {
+    #if defined(__AVX2__)
+        return _mm256_permute4x64_pd(v, _MM_SHUFFLE(3, 1, 0, 2));
+    #else
+        alignas(32) double e[4];
+        store(e);
+        return f64x4(e[2], e[0], e[1], e[3]);
+    #endif
+    }
+
+#elif defined(RT_SIMD_SSE2)
+    __m128d lo, hi;
+
+    f64x4() {}
+    f64x4(__m128d l, __m128d h) : lo(l), hi(h) {}
+    explicit f64x4(double s) : lo(_mm_set1_pd(s)), hi(_mm_set1_pd(s)) {}
+    f64x4(double a, double b, double c, double d) : lo(_mm_setr_pd(a, b)), hi(_mm_setr_pd(c, d)) {}
+
+    // p must be 16-byte aligned
+    static f64x4 load(const double* p) { return f64x4(_mm_load_pd(p), _mm_load_pd(p+2)); }
+    void store(double* p) const { _mm_store_pd(p, lo); _mm_store_pd(p+2, hi); }
+
+    friend f64x4 operator+(f64x4 a, f64x4 b) { return f64x4(_mm_add_pd(a.lo, b.lo), _mm_add_pd(a.hi, b.hi)); }
+    friend f64x4 operator-(f64x4 a, f64x4 b) { return f64x4(_mm_sub_pd(a.lo, b.lo), _mm_sub_pd(a.hi, b.hi)); }
+    friend f64x4 operator*(f64x4 a, f64x4 b) { return f64x4(_mm_mul_pd(a.lo, b.lo), _mm_mul_pd(a.hi, b.hi)); }
+    friend f64x4 operator/(f64x4 a, f64x4 b) { return f64x4(_mm_div_pd(a.lo, b.lo), _mm_div_pd(a.hi, b.hi)); }
+    friend f64x4 vmin(f64x4 a, f64x4 b) { return f64x4(_mm_min_pd(a.lo, b.lo), _mm_min_pd(a.hi, b.hi)); }
+    friend f64x4 vmax(f64x4 a, f64x4 b) { return f64x4(_mm_max_pd(a.lo, b.lo), _mm_max_pd(a.hi, b.hi)); }
+    friend f64x4 vsqrt(f64x4 a) { return f64x4(_mm_sqrt_pd(a.lo), _mm_sqrt_pd(a.hi)); }
+    friend f64x4 vfloor(f64x4 a) {
+        alignas(16) double e[4];
+        a.store(e);
+        return f64x4(std::floor(e[0]), std::floor(e[1]), std::floor(e[2]), std::floor(e[3]));
+    }
+    friend f64x4 vnan_select(f64x4 a, f64x4 b, f64x4 if_nan, f64x4 otherwise) {
+        __m128d lo_mask = _mm_cmpunord_pd(a.lo, b.lo), hi_mask = _mm_cmpunord_pd(a.hi, b.hi);
+        return f64x4(_mm_or_pd(_mm_and_pd(lo_mask, if_nan.lo), _mm_andnot_pd(lo_mask, otherwise.lo)),
+                     _mm_or_pd(_mm_and_pd(hi_mask, if_nan.hi), _mm_andnot_pd(hi_mask, otherwise.hi)));
+    }
+
+    f64x4 operator-() const {
+        const __m128d sign = _mm_set1_pd(-0.0);
+        return f64x4(_mm_xor_pd(lo, sign), _mm_xor_pd(hi, sign));
+    }
+
+    double hsum() const {
+        __m128d s = _mm_add_pd(lo, hi);
+        return _mm_cvtsd_f64(_mm_add_sd(s, _mm_unpackhi_pd(s, s)));
+    }
+
+    double hsum3() const {
+        __m128d s = _mm_add_sd(lo, hi);
+        return _mm_cvtsd_f64(_mm_add_sd(s, _mm_unpackhi_pd(s, s)));
+    }
+
+    f64x4 yzxw() const {
+        // (y, z) and (x, w)
+        return f64x4(_mm_shuffle_pd(lo, hi, 1), _mm_shuffle_pd(lo, hi, 2));
+    }
+
+    f64x4 zxyw() const {
+        // (z, x) and (y, w)
+        return f64x4(_mm_shuffle_pd(hi, lo, 0), _mm_shuffle_pd(lo, hi, 3));
+    }
+
+#else
+    double e[4];
+
+    f64x4() {}
+    explicit f64x4(double s) : e{s, s, s, s} {}
+    f64x4(double a, double b, double c, double d) : e{a, b, c, d} {}
+
+    static f64x4 load(const double* p) { return f64x4(p[0], p[1], p[2], p[3]); }
+    void store(double* p) const { p[0] = e[0]; p[1] = e[1]; p[2] = e[2]; p[3] = e[3]; }
+
+    friend f64x4 operator+(f64x4 a, f64x4 b) { return f64x4(a.e[0]+b.e[0], a.e[1]+b.e[1], a.e[2]+b.e[2], a.e[3]+b.e[3]); }
+    friend f64x4 operator-(f64x4 a, f64x4 b) { return f64x4(a.e[0]-b.e[0], a.e[1]-b.e[1], a.e[2]-b.e[2], a.e[3]-b.e[3]); }
+    friend f64x4 operator*(f64x4 a, f64x4 b) { return f64x4(a.e[0]*b.e[0], a.e[1]*b.e[1], a.e[2]*b.e[2], a.e[3]*b.e[3]); }
+    friend f64x4 operator/(f64x4 a, f64x4 b) { return f64x4(a.e[0]/b.e[0], a.e[1]/b.e[1], a.e[2]/b.e[2], a.e[3]/b.e[3]); }
+    // Same NaN behaviour as minpd/maxpd: the second operand wins
+    friend f64x4 vmin(f64x4 a, f64x4 b) {
+        return f64x4(a.e[0]<b.e[0]?a.e[0]:b.e[0], a.e[1]<b.e[1]?a.e[1]:b.e[1], a.e[2]<b.e[2]?a.e[2]:b.e[2], a.e[3]<b.e[3]?a.e[3]:b.e[3]);
+    }
+    friend f64x4 vmax(f64x4 a, f64x4 b) {
+        return f64x4(a.e[0]>b.e[0]?a.e[0]:b.e[0], a.e[1]>b.e[1]?a.e[1]:b.e[1], a.e[2]>b.e[2]?a.e[2]:b.e[2], a.e[3]>b.e[3]?a.e[3]:b.e[3]);
+    }
+    friend f64x4 vsqrt(f64x4 a) { return f64x4(std::sqrt(a.e[0]), std::sqrt(a.e[1]), std::sqrt(a.e[2]), std::sqrt(a.e[3])); }
+    friend f64x4 vfloor(f64x4 a) { return f64x4(std::floor(a.e[0]), std::floor(a.e[1]), std::floor(a.e[2]), std::floor(a.e[3])); }
+
+    friend f64x4 vnan_select(f64x4 a, f64x4 b, f64x4 if_nan, f64x4 otherwise) {
+        f64x4 r;
+        for (int i=0;i<4;i++)
+            r.e[i] = (a.e[i] != a.e[i] || b.e[i] != b.e[i]) ? if_nan.e[i] : otherwise.e[i];
+        return r;
+    }
+
+    f64x4 operator-() const { return f64x4(-e[0], -e[1], -e[2], -e[3]); }
+
+    double hsum() const { return (e[0]+e[1])+(e[2]+e[3]); }
+    double hsum3() const { return (e[0]+e[1])+e[2]; }
+
+    f64x4 yzxw() const { return f64x4(e[1], e[2], e[0], e[3]); }
+    f64x4 zxyw() const { return f64x4(e[2], e[0], e[1], e[3]); }
+#endif
+
+};
+
+#endif
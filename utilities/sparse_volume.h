@@ -0,0 +1,363 @@
+#ifndef SPARSE_VOLUME_H
+#define SPARSE_VOLUME_H
+
+#include "general.h"
+#include "density_grid.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#ifndef _WIN32
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
+// On-disk layout of a sparse volume (native endianness):
+//
+//   header
+//   int32   slot[brick_count_x * brick_count_y * brick_count_z]   -1 for empty bricks
+//   float   brick_max[stored_bricks]
+//   padding up to a page boundary
+//   float   bricks[stored_bricks][8*8*8]                         x fastest, then y, then z
+//
+// Only bricks with a non-zero voxel are stored. Every brick is 2 KiB, so the
+// data section can be memory-mapped and paged in lazily as rays reach it.
+struct sparse_volume_header {
+    char magic[8];
+    uint32_t version;
+    int32_t nx, ny, nz;
+    int32_t bx, by, bz;
+    double bounds_min[3];
+    double bounds_max[3];
+    uint64_t stored_bricks;
+    uint64_t index_offset;
+    uint64_t max_offset;
+    uint64_t data_offset;
+};
+
+// Sparse brick volume used as a density_field. Lookups that stay inside one
+// brick (7 out of 8 per axis) touch a single 2 KiB block.
+class sparse_volume : public density_field {
+    public:
+        static const int brick_size = 8;
+        static const int brick_voxels = brick_size*brick_size*brick_size;
+
+        sparse_volume() {}
+        sparse_volume(const std::string& path) { open(path); }
+        ~sparse_volume() { close(); }
+
+        sparse_volume(const sparse_volume&) = delete;
+        sparse_volume& operator=(const sparse_volume&) = delete;
+
+        bool open(const std::string& path);
+        void close();
+        bool is_open() const { return base != nullptr; }
+
+        // Writes a sparse volume by evaluating f at every voxel center, one brick at
+        // a time, so the dense grid never has to exist in memory.
+        static bool write(
+            const std::string& path, const aabb& bounds, int nx, int ny, int nz,
+            const std::function<double(const point3&)>& f
+        );
+
+        // Converts an existing dense grid
+        static bool write(const std::string& path, const dense_grid& grid) {
+            return write(path, grid.box, grid.nx, grid.ny, grid.nz, [&grid](const point3& p) {
+                return grid.density(p);
+            });
+        }
+
+        virtual double density(const point3& p) const override;
+        virtual double max_density(const aabb& region) const override;
+        virtual aabb bounds() const override { return box; }
+
+        size_t stored_bricks() const { return static_cast<size_t>(header.stored_bricks); }
+        size_t mapped_bytes() const { return size; }
+
+    private:
+        float fetch(int i, int j, int k) const {
+            if (i < 0 || j < 0 || k < 0 || i >= header.nx || j >= header.ny || k >= header.nz)
+                return 0;
+            auto brick = brick_at(i >> 3, j >> 3, k >> 3);
+            if (!brick)
+                return 0;
+            return brick[((k & 7)*brick_size + (j & 7))*brick_size + (i & 7)];
+        }
+
+        const float* brick_at(int bi, int bj, int bk) const {
+            auto slot = slots[(static_cast<size_t>(bk)*header.by + bj)*header.bx + bi];
+            return slot < 0 ? nullptr : data + static_cast<size_t>(slot)*brick_voxels;
+        }
+
+    public:
+        sparse_volume_header header;
+        aabb box;
+        vec3 inv_cell_size;
+
+    private:
+        const char* base = nullptr;
+        size_t size = 0;
+        const int32_t* slots = nullptr;
+        const float* brick_max = nullptr;
+        const float* data = nullptr;
+        std::vector<char> fallback;    // whole file, where mmap is unavailable
+};
+
+bool sparse_volume :: open(const std::string& path) {
+    close();
+
+#ifndef _WIN32
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        std::cerr << "ERROR: Could not open sparse volume '" << path << "'.\n";
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < static_cast<off_t>(sizeof(sparse_volume_header))) {
+        ::close(fd);
+        std::cerr << "ERROR: Invalid sparse volume '" << path << "'.\n";
+        return false;
+    }
+    size = static_cast<size_t>(st.st_size);
+    void* mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (mapped == MAP_FAILED) {
+        std::cerr << "ERROR: Could not map sparse volume '" << path << "'.\n";
+        size = 0;
+        return false;
+    }
+    base = static_cast<const char*>(mapped);
+#else
+    std::ifstream in(path, std::ios::binary | std::ios::ate);
+    if (!in) {
+        std::cerr << "ERROR: Could not open sparse volume '" << path << "'.\n";
+        return false;
+    }
+    size = static_cast<size_t>(in.tellg());
+    fallback.resize(size);
+    in.seekg(0);
+    in.read(fallback.data(), size);
+    base = fallback.data();
+#endif
+
+    std::memcpy(&header, base, sizeof(header));
+    if (std::memcmp(header.magic, "RTSPVOL", 8) != 0 || header.version != 1) {
+        std::cerr << "ERROR: '" << path << "' is not a sparse volume.\n";
+        close();
+        return false;
+    }
+
+    // Every section has to lie inside the file; counts are divided into the
+    // remaining bytes so corrupt sizes cannot overflow the products
+    auto fits = [this](uint64_t offset, uint64_t count, uint64_t element_bytes) {
+        return offset <= size && count <= (size - offset) / element_bytes;
+    };
+    auto bricks_along = [](int32_t n) { return n/brick_size + (n % brick_size != 0); };
+    const auto& h = header;
+    bool valid = h.nx > 0 && h.ny > 0 && h.nz > 0
+              && h.bx == bricks_along(h.nx) && h.by == bricks_along(h.ny) && h.bz == bricks_along(h.nz)
+              && fits(h.index_offset, static_cast<uint64_t>(h.bx)*h.by, h.bz*sizeof(int32_t))
+              && fits(h.max_offset, h.stored_bricks, sizeof(float))
+              && fits(h.data_offset, h.stored_bricks, brick_voxels*sizeof(float));
+    for (int a=0;a<3 && valid;a++)
+        valid = h.bounds_min[a] < h.bounds_max[a];
+
+    // Slots index the data section
+    if (valid) {
+        auto index = base + h.index_offset;
+        auto brick_count = static_cast<size_t>(h.bx)*h.by*h.bz;
+        for (size_t i=0;i<brick_count && valid;i++){
+            int32_t slot;
+            std::memcpy(&slot, index + i*sizeof(slot), sizeof(slot));
+            valid = slot >= -1 && (slot < 0 || static_cast<uint64_t>(slot) < h.stored_bricks);
+        }
+    }
+
+    if (!valid) {
+        std::cerr << "ERROR: Sparse volume '" << path << "' is truncated or corrupt.\n";
+        close();
+        return false;
+    }
+
+    slots = reinterpret_cast<const int32_t*>(base + header.index_offset);
+    brick_max = reinterpret_cast<const float*>(base + header.max_offset);
+    data = reinterpret_cast<const float*>(base + header.data_offset);
+
+    box = aabb(point3(header.bounds_min[0], header.bounds_min[1], header.bounds_min[2]),
+               point3(header.bounds_max[0], header.bounds_max[1], header.bounds_max[2]));
+    auto extent = box.max() - box.min();
+    inv_cell_size = vec3(header.nx/extent.x(), header.ny/extent.y(), header.nz/extent.z());
+
+    return true;
+}
+
+void sparse_volume :: close() {
+#ifndef _WIN32
+    if (base && fallback.empty())
+        munmap(const_cast<char*>(base), size);
+#endif
+    fallback.clear();
+    base = nullptr;
+    size = 0;
+    slots = nullptr;
+    brick_max = nullptr;
+    data = nullptr;
+}
+
+bool sparse_volume :: write(
+    const std::string& path, const aabb& bounds, int nx, int ny, int nz,
+    const std::function<double(const point3&)>& f
+) {
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    if (!out) {
+        std::cerr << "ERROR: Could not write sparse volume '" << path << "'.\n";
+        return false;
+    }
+
+    sparse_volume_header h;
+    std::memcpy(h.magic, "RTSPVOL", 8);
+    h.version = 1;
+    h.nx = nx; h.ny = ny; h.nz = nz;
+    h.bx = (nx + brick_size-1) / brick_size;
+    h.by = (ny + brick_size-1) / brick_size;
+    h.bz = (nz + brick_size-1) / brick_size;
+    for (int a=0;a<3;a++){
+        h.bounds_min[a] = bounds.min()[a];
+        h.bounds_max[a] = bounds.max()[a];
+    }
+
+    auto brick_count = static_cast<size_t>(h.bx)*h.by*h.bz;
+    auto extent = bounds.max() - bounds.min();
+    vec3 cell(extent.x()/nx, extent.y()/ny, extent.z()/nz);
+
+    // The slot table and per-brick maxima are small and kept in memory; brick
+    // data is streamed to disk one brick at a time.
+    std::vector<int32_t> slot_table(brick_count, -1);
+    std::vector<float> maxima;
+    std::vector<float> brick(brick_voxels);
+
+    // First pass only decides occupancy (stopping at the first non-zero voxel),
+    // so the data section can be placed before any brick is written.
+    size_t stored = 0;
+    for (int bk=0;bk<h.bz;bk++)
+        for (int bj=0;bj<h.by;bj++)
+            for (int bi=0;bi<h.bx;bi++){
+                bool any = false;
+                for (int k=bk*brick_size;k<std::min((bk+1)*brick_size, nz) && !any;k++)
+                    for (int j=bj*brick_size;j<std::min((bj+1)*brick_size, ny) && !any;j++)
+                        for (int i=bi*brick_size;i<std::min((bi+1)*brick_size, nx) && !any;i++)
+                            any = f(bounds.min() + vec3((i+0.5)*cell.x(), (j+0.5)*cell.y(), (k+0.5)*cell.z())) != 0;
+                if (any) {
+                    slot_table[(static_cast<size_t>(bk)*h.by + bj)*h.bx + bi] = static_cast<int32_t>(stored++);
+                }
+            }
+
+    h.stored_bricks = stored;
+    h.index_offset = sizeof(h);
+    h.max_offset = h.index_offset + brick_count*sizeof(int32_t);
+    const size_t page = 4096;
+    h.data_offset = (h.max_offset + stored*sizeof(float) + page-1) / page * page;
+    maxima.assign(stored, 0.0f);
+
+    // Second pass streams the occupied bricks into the data section
+    out.seekp(static_cast<std::streamoff>(h.data_offset));
+    for (int bk=0;bk<h.bz;bk++)
+        for (int bj=0;bj<h.by;bj++)
+            for (int bi=0;bi<h.bx;bi++){
+                auto slot = slot_table[(static_cast<size_t>(bk)*h.by + bj)*h.bx + bi];
+                if (slot < 0)
+                    continue;
+
+                float m = 0;
+                for (int k=0;k<brick_size;k++)
+                    for (int j=0;j<brick_size;j++)
+                        for (int i=0;i<brick_size;i++){
+                            int gi = bi*brick_size + i, gj = bj*brick_size + j, gk = bk*brick_size + k;
+                            float v = 0;
+                            if (gi < nx && gj < ny && gk < nz)
+                                v = static_cast<float>(f(bounds.min() + vec3((gi+0.5)*cell.x(), (gj+0.5)*cell.y(), (gk+0.5)*cell.z())));
+                            brick[(k*brick_size + j)*brick_size + i] = v;
+                            m = std::max(m, v);
+                        }
+                maxima[slot] = m;
+                out.write(reinterpret_cast<const char*>(brick.data()), brick_voxels*sizeof(float));
+            }
+
+    out.seekp(0);
+    out.write(reinterpret_cast<const char*>(&h), sizeof(h));
+    out.write(reinterpret_cast<const char*>(slot_table.data()), brick_count*sizeof(int32_t));
+    out.write(reinterpret_cast<const char*>(maxima.data()), stored*sizeof(float));
+
+    return static_cast<bool>(out);
+}
+
+double sparse_volume :: density(const point3& p) const {
+    auto g = (p - box.min()) * inv_cell_size - vec3(0.5, 0.5, 0.5);
+
+    auto fx = floor(g.x()), fy = floor(g.y()), fz = floor(g.z());
+    auto tx = g.x()-fx, ty = g.y()-fy, tz = g.z()-fz;
+    int i = static_cast<int>(fx), j = static_cast<int>(fy), k = static_cast<int>(fz);
+
+    float c[2][2][2];
+    if (i >= 0 && j >= 0 && k >= 0 && i+1 < header.nx && j+1 < header.ny && k+1 < header.nz
+        && (i & 7) != 7 && (j & 7) != 7 && (k & 7) != 7) {
+        // All eight taps are in the same brick
+        auto brick = brick_at(i >> 3, j >> 3, k >> 3);
+        if (!brick)
+            return 0;
+        auto v = brick + ((k & 7)*brick_size + (j & 7))*brick_size + (i & 7);
+        c[0][0][0] = v[0];                      c[1][0][0] = v[1];
+        c[0][1][0] = v[brick_size];             c[1][1][0] = v[brick_size+1];
+        c[0][0][1] = v[brick_size*brick_size];  c[1][0][1] = v[brick_size*brick_size+1];
+        c[0][1][1] = v[brick_size*brick_size+brick_size];
+        c[1][1][1] = v[brick_size*brick_size+brick_size+1];
+    } else {
+        for (int di=0;di<2;di++)
+            for (int dj=0;dj<2;dj++)
+                for (int dk=0;dk<2;dk++)
+                    c[di][dj][dk] = fetch(i+di, j+dj, k+dk);
+    }
+
+    auto c00 = c[0][0][0] + tx*(c[1][0][0]-c[0][0][0]), c10 = c[0][1][0] + tx*(c[1][1][0]-c[0][1][0]);
+    auto c01 = c[0][0][1] + tx*(c[1][0][1]-c[0][0][1]), c11 = c[0][1][1] + tx*(c[1][1][1]-c[0][1][1]);
+    auto c0 = c00 + ty*(c10-c00), c1 = c01 + ty*(c11-c01);
+    return c0 + tz*(c1-c0);
+}
+
+double sparse_volume :: max_density(const aabb& region) const {
+    // Voxels that can contribute to region, widened by one for interpolation
+    auto lo = (region.min() - box.min()) * inv_cell_size - vec3(0.5, 0.5, 0.5);
+    auto hi = (region.max() - box.min()) * inv_cell_size - vec3(0.5, 0.5, 0.5);
+
+    int b0[3], b1[3];
+    int n[3] = {header.nx, header.ny, header.nz};
+    int nb[3] = {header.bx, header.by, header.bz};
+    for (int a=0;a<3;a++){
+        int v0 = std::max(static_cast<int>(floor(clamp(lo[a], -1, n[a]))), 0);
+        int v1 = std::min(static_cast<int>(floor(clamp(hi[a], -1, n[a]))) + 1, n[a]-1);
+        b0[a] = v0 / brick_size;
+        b1[a] = std::min(v1 / brick_size, nb[a]-1);
+        if (v1 < v0)
+            return 0;
+    }
+
+    float m = 0;
+    for (int bk=b0[2];bk<=b1[2];bk++)
+        for (int bj=b0[1];bj<=b1[1];bj++)
+            for (int bi=b0[0];bi<=b1[0];bi++){
+                auto slot = slots[(static_cast<size_t>(bk)*header.by + bj)*header.bx + bi];
+                if (slot >= 0)
+                    m = std::max(m, brick_max[slot]);
+            }
+    return m;
+}
+
+#endif
@@ -15,6 +15,13 @@ class sphere : public hittable{
         virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override;
         virtual bool bounding_box(double time0, double time1, aabb& output_bounding_box) const override;
 
+        // Point on the surface with texture coordinates (u, v), the inverse of get_sphere_uv
+        point3 surface_point(double u, double v) const {
+            auto theta = v * pi;
+            auto phi = u * 2*pi - pi;
+            return center + radius * vec3(sin(theta)*cos(phi), -cos(theta), -sin(theta)*sin(phi));
+        }
+
     public:
         point3 center;
         double radius;
@@ -39,6 +46,7 @@ class sphere : public hittable{
 };
 
 bool sphere :: hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
+    RT_STAT_INC(sphere_tests);
     auto oc = r.origin() - center;
     auto b_half = (dot(r.direction(), oc));
     auto a = r.direction().length_squared();
@@ -63,9 +71,11 @@ bool sphere :: hit(const ray& r, double t_min, double t_max, hit_record& rec) co
     rec.p = r.at(rec.t);
     vec3 outward_normal = (rec.p - center) / radius;
     rec.set_face_normal(r, outward_normal);
-    rec.mat_ptr = mat_ptr;
+    rec.mat_ptr = mat_ptr.get();
     // auto d = unit_vector(center - rec.p);
     get_sphere_uv(outward_normal, rec.u, rec.v);
+    // v spans half a great circle
+    rec.set_footprint(r, pi*radius);
     
     return true;
 }
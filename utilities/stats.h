@@ -0,0 +1,247 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Render statistics. Hot-path counters are per thread and only exist when built
+// with RAY_TRACING_STATS (CMake option RAY_TRACING_STATS); otherwise the
+// RT_STAT_* macros expand to nothing. Phase timings are always recorded.
+namespace stats {
+
+enum counter {
+    bvh_nodes_visited,
+
+    // Primitive intersection tests
+    sphere_tests,
+    moving_sphere_tests,
+    xy_rect_tests,
+    xz_rect_tests,
+    yz_rect_tests,
+    box_tests,
+    transform_tests,
+    constant_medium_tests,
+    heterogeneous_medium_tests,
+
+    // material::scatter calls
+    lambertian_scatters,
+    metal_scatters,
+    dielectric_scatters,
+    diffuse_light_scatters,
+    isotropic_scatters,
+
+    // Medium events
+    global_medium_scatters,
+    constant_medium_scatters,
+    heterogeneous_null_collisions,
+    heterogeneous_scatters,
+
+    counter_count
+};
+
+inline const char* counter_name(int c) {
+    static const char* names[counter_count] = {
+        "bvh_nodes_visited",
+        "sphere_tests", "moving_sphere_tests", "xy_rect_tests", "xz_rect_tests", "yz_rect_tests",
+        "box_tests", "transform_tests", "constant_medium_tests", "heterogeneous_medium_tests",
+        "lambertian_scatters", "metal_scatters", "dielectric_scatters", "diffuse_light_scatters",
+        "isotropic_scatters",
+        "global_medium_scatters", "constant_medium_scatters", "heterogeneous_null_collisions",
+        "heterogeneous_scatters"
+    };
+    return names[c];
+}
+
+// Rays are counted per bounce; deeper bounces share the last bucket
+const int bounce_buckets = 64;
+
+struct counters {
+    uint64_t values[counter_count] = {};
+    uint64_t rays[bounce_buckets] = {};
+
+    void merge(const counters& other) {
+        for (int i=0;i<counter_count;i++)
+            values[i] += other.values[i];
+        for (int i=0;i<bounce_buckets;i++)
+            rays[i] += other.rays[i];
+    }
+
+    uint64_t total_rays() const {
+        uint64_t n = 0;
+        for (auto r : rays)
+            n += r;
+        return n;
+    }
+};
+
+// Totals of finished threads plus the threads still running, and the phase
+// timings
+class registry {
+    public:
+        static registry& global() {
+            static registry r;
+            return r;
+        }
+
+        void attach(counters* c) {
+            std::lock_guard<std::mutex> lock(m);
+            live.insert(c);
+        }
+
+        // Called at thread exit
+        void detach(counters* c) {
+            std::lock_guard<std::mutex> lock(m);
+            finished.merge(*c);
+            live.erase(c);
+        }
+
+        counters snapshot() const {
+            std::lock_guard<std::mutex> lock(m);
+            auto total = finished;
+            for (auto c : live)
+                total.merge(*c);
+            return total;
+        }
+
+        void add_phase(const std::string& name, double seconds) {
+            std::lock_guard<std::mutex> lock(m);
+            phases.emplace_back(name, seconds);
+        }
+
+        std::vector<std::pair<std::string, double>> phase_times() const {
+            std::lock_guard<std::mutex> lock(m);
+            return phases;
+        }
+
+    private:
+        mutable std::mutex m;
+        counters finished;
+        std::set<counters*> live;
+        std::vector<std::pair<std::string, double>> phases;
+};
+
+#ifdef RAY_TRACING_STATS
+// This thread's counters, merged into the registry when the thread exits
+struct thread_counters : counters {
+    thread_counters() { registry::global().attach(this); }
+    ~thread_counters() { registry::global().detach(this); }
+};
+
+inline counters& local() {
+    thread_local thread_counters c;
+    return c;
+}
+
+#define RT_STAT_INC(name) (++::stats::local().values[::stats::name])
+#define RT_STAT_ADD(name, n) (::stats::local().values[::stats::name] += (n))
+#define RT_STAT_RAY(bounce) (++::stats::local().rays[(bounce) < ::stats::bounce_buckets ? (bounce) : ::stats::bounce_buckets-1])
+const bool enabled = true;
+#else
+#define RT_STAT_INC(name) ((void)0)
+#define RT_STAT_ADD(name, n) ((void)0)
+#define RT_STAT_RAY(bounce) ((void)0)
+const bool enabled = false;
+#endif
+
+// Records consecutive phases: each lap() closes the phase that began at the
+// previous lap (or construction)
+class phase_clock {
+    public:
+        phase_clock() : start(std::chrono::steady_clock::now()) {}
+
+        double lap(const std::string& name) {
+            auto now = std::chrono::steady_clock::now();
+            double seconds = std::chrono::duration<double>(now - start).count();
+            start = now;
+            registry::global().add_phase(name, seconds);
+            return seconds;
+        }
+
+    private:
+        std::chrono::steady_clock::time_point start;
+};
+
+inline double phase_seconds(const std::string& name) {
+    for (const auto& p : registry::global().phase_times())
+        if (p.first == name)
+            return p.second;
+    return 0;
+}
+
+// Human-readable report; rays per second are over the "render" phase
+inline void print_report(std::ostream& out) {
+    out << "Phases:\n";
+    for (const auto& p : registry::global().phase_times())
+        out << "  " << std::left << std::setw(32) << p.first << std::fixed << std::setprecision(3) << p.second << " s\n";
+
+    if (!enabled) {
+        out << "Counters disabled (build with RAY_TRACING_STATS=ON).\n";
+        return;
+    }
+
+    auto c = registry::global().snapshot();
+    auto rays = c.total_rays();
+    auto render = phase_seconds("render");
+    out << "Rays: " << rays;
+    if (render > 0)
+        out << " (" << std::setprecision(2) << rays / render / 1e6 << " Mrays/s)";
+    out << "\n";
+
+    int last = bounce_buckets - 1;
+    while (last > 0 && c.rays[last] == 0)
+        last--;
+    for (int i=0;i<=last;i++)
+        out << "  " << std::setw(32) << ("bounce " + std::to_string(i)) << c.rays[i] << "\n";
+
+    out << "Counters:\n";
+    for (int i=0;i<counter_count;i++)
+        if (c.values[i])
+            out << "  " << std::setw(32) << counter_name(i) << c.values[i] << "\n";
+    out << std::right;
+}
+
+// The same report as JSON
+inline bool write_json(const std::string& path) {
+    std::ofstream out(path);
+    if (!out) {
+        std::cerr << "ERROR: Could not write '" << path << "'.\n";
+        return false;
+    }
+
+    out << "{\n  \"phases\": {";
+    auto phases = registry::global().phase_times();
+    for (size_t i=0;i<phases.size();i++)
+        out << (i ? ", " : "") << "\"" << phases[i].first << "\": " << phases[i].second;
+    out << "},\n  \"counters_enabled\": " << (enabled ? "true" : "false");
+
+    if (enabled) {
+        auto c = registry::global().snapshot();
+        auto render = phase_seconds("render");
+        out << ",\n  \"rays\": " << c.total_rays();
+        out << ",\n  \"rays_per_second\": " << (render > 0 ? c.total_rays() / render : 0.0);
+        out << ",\n  \"rays_per_bounce\": [";
+        int last = bounce_buckets - 1;
+        while (last > 0 && c.rays[last] == 0)
+            last--;
+        for (int i=0;i<=last;i++)
+            out << (i ? ", " : "") << c.rays[i];
+        out << "],\n  \"counters\": {";
+        for (int i=0;i<counter_count;i++)
+            out << (i ? ", " : "") << "\"" << counter_name(i) << "\": " << c.values[i];
+        out << "}";
+    }
+    out << "\n}\n";
+    return static_cast<bool>(out);
+}
+
+}
+
+#endif
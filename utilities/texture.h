@@ -4,6 +4,7 @@
 #include "general.h"
 #include "image.h"
 #include "perlin.h"
+#include "texture_cache.h"
 
 #include <iostream>
 
@@ -11,6 +12,12 @@
 class texture {
     public:
         virtual color value(double u, double v, const point3& p) const = 0;
+
+        // Lookup over a footprint (in uv units) instead of a point. Textures that
+        // can filter override this; the rest ignore the footprint.
+        virtual color value(double u, double v, const point3& p, double footprint) const {
+            return value(u, v, p);
+        }
 };
 
 // Constant color texture
@@ -38,14 +45,18 @@ class checker_texture : public texture{
         ) : even(_even), odd(_odd), scale(_scale) {}
 
         checker_texture(color c1, color c2, int _scale = 10)
-            : even(make_shared<solid_color>(c1)), odd(make_shared<solid_color>(c2)), scale(_scale) {}
+            : even(make_scene_shared<solid_color>(c1)), odd(make_scene_shared<solid_color>(c2)), scale(_scale) {}
         
         virtual color value(double u, double v, const point3& p) const override {
+            return value(u, v, p, 0);
+        }
+
+        virtual color value(double u, double v, const point3& p, double footprint) const override {
             auto sines = sin(scale*p.x())*sin(scale*p.y())*sin(scale*p.z());
             if (sines < 0)
-                return odd->value(u, v, p);
+                return odd->value(u, v, p, footprint);
             else    
-                return even->value(u, v, p);
+                return even->value(u, v, p, footprint);
         }
 
     public:
@@ -70,58 +81,76 @@ class noise_texture : public texture {
         double scale;
 };
 
-// Texture from an image
+// Texture from an image. The pixels live in the global texture_cache as a
+// tiled, mip-mapped float pyramid; lookups are bilinear and only the tiles they
+// touch are resident.
 class image_texture : public texture {
     public:
         const static int bytes_per_pixel = 3;
 
         image_texture()
-          : data(nullptr), width(0), height(0), bytes_per_scanline(0) {}
+          : handle(-1), width(0), height(0) {}
 
-        image_texture(const char* filename) {
+        image_texture(const char* filename) : image_texture() {
+            load(filename);
+        }
+
+        // Decodes filename into the texture cache. Safe to call for different
+        // textures from several threads at once.
+        void load(const char* filename) {
             auto components_per_pixel = bytes_per_pixel;
 
-            data = stbi_load(
+            unsigned char* data = stbi_load(
                 filename, &width, &height, &components_per_pixel, components_per_pixel);
 
             if (!data) {
                 std::cerr << "ERROR: Could not load texture image file '" << filename << "'.\n";
                 width = height = 0;
+                handle = -1;
+                return;
             }
 
-            bytes_per_scanline = bytes_per_pixel * width;
+            // Same value range the old 8-bit lookups returned
+            const float color_scale = 1.0f / 255.0f;
+            std::vector<float> pixels(static_cast<size_t>(width)*height*bytes_per_pixel);
+            for (size_t i=0;i<pixels.size();i++)
+                pixels[i] = color_scale * data[i];
+            stbi_image_free(data);
+
+            load_pixels(pixels.data(), width, height);
         }
 
-        ~image_texture() {
-            delete data;
+        // Adopts float RGB rows (top row first), e.g. a baked procedural texture
+        void load_pixels(const float* rgb, int w, int h) {
+            width = w;
+            height = h;
+            handle = texture_cache::global().add_image(rgb, width, height);
         }
 
         virtual color value(double u, double v, const vec3& p) const override {
-            // If we have no texture data, then return solid cyan as a debugging aid.
-            if (data == nullptr)
-                return color(0,1,1);
-
-            // Clamp input texture coordinates to [0,1] x [1,0]
-            u = clamp(u, 0.0, 1.0);
-            v = 1.0 - clamp(v, 0.0, 1.0);  // Flip V to image coordinates
-
-            auto i = static_cast<int>(u * width);
-            auto j = static_cast<int>(v * height);
+            return sample(u, v, 0);
+        }
 
-            // Clamp integer mapping, since actual coordinates should be less than 1.0
-            if (i >= width)  i = width-1;
-            if (j >= height) j = height-1;
+        virtual color value(double u, double v, const vec3& p, double footprint) const override {
+            return sample(u, v, footprint);
+        }
 
-            const auto color_scale = 1.0 / 255.0;
-            auto pixel = data + j*bytes_per_scanline + i*bytes_per_pixel;
+        // footprint is the lookup width in uv units and selects the mip level
+        color sample(double u, double v, double footprint) const {
+            // If we have no texture data, then return solid cyan as a debugging aid.
+            if (handle < 0)
+                return color(0,1,1);
 
-            return color(color_scale*pixel[0], color_scale*pixel[1], color_scale*pixel[2]);
+            // Flip V to image coordinates
+            return texture_cache::global().sample(handle, u, 1.0 - clamp(v, 0.0, 1.0), footprint);
         }
 
+        // The image's handle in texture_cache::global(), -1 without data
+        int cache_handle() const { return handle; }
+
     private:
-        unsigned char *data;
+        int handle;
         int width, height;
-        int bytes_per_scanline;
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,115 @@
+#ifndef TEXTURE_BAKE_H
+#define TEXTURE_BAKE_H
+
+#include "general.h"
+
+#include "texture.h"
+#include "thread_pool.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <future>
+#include <iostream>
+#include <vector>
+
+// Baking evaluates a procedural texture once per texel over a surface's uv
+// domain and serves later lookups from the texture cache. Only static textures
+// on surfaces with a one-to-one uv mapping (spheres, rects) bake correctly.
+namespace texture_bake {
+    // Header of a baked texture file, followed by width*height float RGB texels
+    struct file_header {
+        char magic[8];      // "RTBAKE1"
+        int32_t width;
+        int32_t height;
+    };
+
+    const char magic[8] = "RTBAKE1";
+
+    // Reads a previously baked file; fails if it is missing or of another size
+    inline bool read(const char* path, int width, int height, std::vector<float>& pixels) {
+        auto f = std::fopen(path, "rb");
+        if (!f)
+            return false;
+
+        file_header header;
+        pixels.resize(static_cast<size_t>(width)*height*3);
+        bool ok = std::fread(&header, sizeof(header), 1, f) == 1
+            && std::memcmp(header.magic, magic, sizeof(magic)) == 0
+            && header.width == width && header.height == height
+            && std::fread(pixels.data(), sizeof(float), pixels.size(), f) == pixels.size();
+        std::fclose(f);
+        return ok;
+    }
+
+    inline bool write(const char* path, int width, int height, const std::vector<float>& pixels) {
+        auto f = std::fopen(path, "wb");
+        if (!f) {
+            std::cerr << "ERROR: Could not write baked texture '" << path << "'.\n";
+            return false;
+        }
+
+        file_header header;
+        std::memcpy(header.magic, magic, sizeof(magic));
+        header.width = width;
+        header.height = height;
+        bool ok = std::fwrite(&header, sizeof(header), 1, f) == 1
+            && std::fwrite(pixels.data(), sizeof(float), pixels.size(), f) == pixels.size();
+        std::fclose(f);
+        return ok;
+    }
+}
+
+// Bakes tex into a width x height image. surface maps texture coordinates to
+// the point the texture is evaluated at. If cache_path is given, an earlier
+// bake of the same size is read from it instead, and a new bake is saved to
+// it; the path is the cache key, so use a new one when the texture changes.
+inline shared_ptr<image_texture> bake_texture(
+    shared_ptr<texture> tex, const std::function<point3(double, double)>& surface,
+    int width, int height, const char* cache_path = nullptr
+) {
+    std::vector<float> pixels;
+
+    if (!cache_path || !texture_bake::read(cache_path, width, height, pixels)) {
+        pixels.assign(static_cast<size_t>(width)*height*3, 0.0f);
+
+        // Rows are independent; texel centers, row 0 at v = 1
+        thread_pool pool;
+        std::vector<std::future<void>> rows;
+        for (int y=0;y<height;y++)
+            rows.push_back(pool.submit([&, y]{
+                auto v = 1.0 - (y + 0.5) / height;
+                for (int x=0;x<width;x++){
+                    auto u = (x + 0.5) / width;
+                    auto c = tex->value(u, v, surface(u, v));
+                    auto out = &pixels[(static_cast<size_t>(y)*width + x)*3];
+                    out[0] = static_cast<float>(c.x());
+                    out[1] = static_cast<float>(c.y());
+                    out[2] = static_cast<float>(c.z());
+                }
+            }));
+        for (auto& r : rows)
+            r.get();
+
+        if (cache_path)
+            texture_bake::write(cache_path, width, height, pixels);
+    }
+
+    auto baked = make_shared<image_texture>();
+    baked->load_pixels(pixels.data(), width, height);
+    return baked;
+}
+
+// Bakes tex over any surface with a surface_point(u, v) member (sphere, rects)
+template <typename surface_type>
+auto bake_texture(
+    shared_ptr<texture> tex, const surface_type& surface,
+    int width, int height, const char* cache_path = nullptr
+) -> decltype(surface.surface_point(0.0, 0.0), shared_ptr<image_texture>()) {
+    return bake_texture(
+        tex, [&surface](double u, double v) { return surface.surface_point(u, v); },
+        width, height, cache_path);
+}
+
+#endif
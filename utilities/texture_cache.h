@@ -0,0 +1,457 @@
+#ifndef TEXTURE_CACHE_H
+#define TEXTURE_CACHE_H
+
+#include "general.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <iostream>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// Square block of float RGB texels, the unit the cache loads and evicts
+struct texture_tile {
+    static const int size = 32;
+    float texels[size*size*3];
+};
+
+// Process-wide cache for image textures. Images are converted once into a mip
+// pyramid of float RGB tiles and written to a temporary backing file; only the
+// tiles that lookups actually touch are read back, into an LRU cache whose
+// total size stays under a configurable limit.
+//
+// Lookups take no lock on the common path. Each thread keeps a small table of
+// raw pointers to the tiles it used last and pins the current epoch while a
+// lookup runs; evicted tiles are retired, and freed only once no thread is
+// pinned at or before the epoch they were retired in. An eviction anywhere
+// advances the epoch, which invalidates every thread's table.
+class texture_cache {
+    public:
+        static const int shard_count = 16;
+        static const int thread_slots = 64;     // per-thread tile table
+
+        static texture_cache& global() {
+            static texture_cache cache;
+            return cache;
+        }
+
+        texture_cache(size_t limit_bytes = 256u << 20) : id(next_id()), backing(std::tmpfile()) {
+            set_memory_limit(limit_bytes);
+            if (!backing)
+                std::cerr << "ERROR: Could not create texture cache backing file.\n";
+        }
+
+        ~texture_cache() {
+            if (backing)
+                std::fclose(backing);
+        }
+
+        texture_cache(const texture_cache&) = delete;
+        texture_cache& operator=(const texture_cache&) = delete;
+
+        // Upper bound for resident tiles, split evenly between shards
+        void set_memory_limit(size_t limit_bytes) {
+            auto per_shard = std::max<size_t>(limit_bytes / shard_count / sizeof(texture_tile), 1);
+            std::vector<std::unique_ptr<texture_tile>> evicted;
+            for (auto& s : shards) {
+                std::lock_guard<std::mutex> lock(s.m);
+                s.capacity = per_shard;
+                s.evict_to(s.capacity, evicted);
+            }
+            retire(evicted);
+        }
+
+        // Adds an image given as float RGB rows (top row first) and returns its
+        // handle. The caller's pixels can be freed as soon as this returns.
+        // Images must all be added before rendering starts: lookups read the
+        // image table without locking.
+        int add_image(const float* rgb, int width, int height);
+
+        int width(int handle, int level = 0) const { return images[handle].levels[level].width; }
+        int height(int handle, int level = 0) const { return images[handle].levels[level].height; }
+        int level_count(int handle) const { return static_cast<int>(images[handle].levels.size()); }
+
+        // Filtered lookup. footprint is the width of the lookup in uv units; it
+        // picks the mip level, and neighbouring levels are blended (trilinear).
+        color sample(int handle, double u, double v, double footprint = 0) const;
+
+        // Bilinear lookup within one level, clamping at the edges. u, v in [0,1],
+        // v = 0 at the top row.
+        color bilinear(int handle, int level, double u, double v) const;
+
+        color texel(int handle, int level, int x, int y) const;
+
+        // Counters since startup
+        size_t resident_bytes() const;
+        size_t backing_bytes() const { return backing_size * sizeof(float); }
+        size_t hits() const;
+        size_t misses() const;
+
+    private:
+        struct level_info {
+            int width, height;
+            int tiles_x, tiles_y;
+            long first_tile;    // index of the level's first tile in the backing file
+        };
+
+        struct image_info {
+            std::vector<level_info> levels;
+        };
+
+        typedef std::list<std::pair<uint64_t, std::unique_ptr<texture_tile>>> tile_list;
+
+        // LRU order comes from lookups that miss the thread tables, so it is
+        // approximate for tiles a thread keeps hitting
+        struct shard {
+            mutable std::mutex m;
+            tile_list lru;      // most recent first
+            std::unordered_map<uint64_t, tile_list::iterator> map;
+            size_t capacity = 1;
+            size_t hits = 0, misses = 0;
+
+            void evict_to(size_t n, std::vector<std::unique_ptr<texture_tile>>& evicted) {
+                while (lru.size() > n) {
+                    map.erase(lru.back().first);
+                    evicted.push_back(std::move(lru.back().second));
+                    lru.pop_back();
+                }
+            }
+        };
+
+        // Per-thread state: the pinned epoch (0 outside lookups) and the tiles
+        // used last. Only the owning thread writes it.
+        struct reader {
+            struct slot {
+                uint64_t key = 0;
+                uint64_t epoch = 0;     // epoch it was filled in; 0 for empty
+                const texture_tile* tile = nullptr;
+            };
+
+            std::thread::id thread;
+            std::atomic<uint64_t> pinned{0};
+            int depth = 0;
+            uint64_t current = 0;       // epoch seen by the outermost lookup
+            std::atomic<size_t> hits{0};
+            slot slots[thread_slots];
+        };
+
+        // Keeps the calling thread pinned for the lifetime of a lookup; nests
+        class pin {
+            public:
+                explicit pin(const texture_cache& cache) : r(cache.reader_for_this_thread()) {
+                    if (r.depth++ == 0) {
+                        r.pinned.store(cache.epoch.load());
+                        r.current = cache.epoch.load();
+                    }
+                }
+                ~pin() {
+                    if (--r.depth == 0)
+                        r.pinned.store(0, std::memory_order_release);
+                }
+
+                pin(const pin&) = delete;
+                pin& operator=(const pin&) = delete;
+
+                reader& r;
+        };
+
+        static uint64_t tile_key(int handle, int level, int tx, int ty) {
+            return (static_cast<uint64_t>(handle) << 40) | (static_cast<uint64_t>(level) << 34)
+                 | (static_cast<uint64_t>(ty) << 17) | static_cast<uint64_t>(tx);
+        }
+
+        static uint64_t next_id() {
+            static std::atomic<uint64_t> ids{1};
+            return ids++;
+        }
+
+        // Valid until the pinned lookup that fetched it ends
+        const texture_tile* fetch_tile(reader& r, int handle, int level, int tx, int ty) const;
+
+        reader& reader_for_this_thread() const;
+        void retire(std::vector<std::unique_ptr<texture_tile>>& tiles) const;
+
+    private:
+        uint64_t id;
+        std::FILE* backing;
+        mutable std::mutex file_mutex;
+        long tile_count = 0;
+        size_t backing_size = 0;
+
+        // Grows only; handles index into it. Images are added at scene load and
+        // read without locking while rendering.
+        std::vector<image_info> images;
+        mutable shard shards[shard_count];
+
+        mutable std::atomic<uint64_t> epoch{1};
+        mutable std::mutex readers_mutex;
+        mutable std::vector<std::unique_ptr<reader>> readers;
+        mutable std::mutex retired_mutex;
+        mutable std::vector<std::pair<uint64_t, std::unique_ptr<texture_tile>>> retired;   // with their epoch
+};
+
+int texture_cache :: add_image(const float* rgb, int width, int height) {
+    const int ts = texture_tile::size;
+
+    // Build the mip chain with a 2x2 box filter (edge texels repeated for odd sizes)
+    std::vector<std::vector<float>> pyramid(1, std::vector<float>(rgb, rgb + static_cast<size_t>(width)*height*3));
+    std::vector<std::pair<int, int>> sizes(1, std::make_pair(width, height));
+    while (sizes.back().first > 1 || sizes.back().second > 1) {
+        int pw = sizes.back().first, ph = sizes.back().second;
+        int w = std::max(pw / 2, 1), h = std::max(ph / 2, 1);
+        const auto& src = pyramid.back();
+        std::vector<float> dst(static_cast<size_t>(w)*h*3);
+        for (int y=0;y<h;y++)
+            for (int x=0;x<w;x++){
+                int x0 = std::min(2*x, pw-1), x1 = std::min(2*x+1, pw-1);
+                int y0 = std::min(2*y, ph-1), y1 = std::min(2*y+1, ph-1);
+                for (int c=0;c<3;c++)
+                    dst[(static_cast<size_t>(y)*w + x)*3 + c] = 0.25f * (
+                        src[(static_cast<size_t>(y0)*pw + x0)*3 + c] + src[(static_cast<size_t>(y0)*pw + x1)*3 + c] +
+                        src[(static_cast<size_t>(y1)*pw + x0)*3 + c] + src[(static_cast<size_t>(y1)*pw + x1)*3 + c]);
+            }
+        pyramid.push_back(std::move(dst));
+        sizes.push_back(std::make_pair(w, h));
+    }
+
+    std::lock_guard<std::mutex> lock(file_mutex);
+
+    image_info info;
+    texture_tile tile;
+    for (size_t l=0;l<pyramid.size();l++){
+        level_info level;
+        level.width = sizes[l].first;
+        level.height = sizes[l].second;
+        level.tiles_x = (level.width + ts-1) / ts;
+        level.tiles_y = (level.height + ts-1) / ts;
+        level.first_tile = tile_count;
+
+        // Tiles are written row by row; texels past the edge repeat the border
+        for (int ty=0;ty<level.tiles_y;ty++)
+            for (int tx=0;tx<level.tiles_x;tx++){
+                for (int y=0;y<ts;y++)
+                    for (int x=0;x<ts;x++){
+                        int sx = std::min(tx*ts + x, level.width-1);
+                        int sy = std::min(ty*ts + y, level.height-1);
+                        for (int c=0;c<3;c++)
+                            tile.texels[(y*ts + x)*3 + c] = pyramid[l][(static_cast<size_t>(sy)*level.width + sx)*3 + c];
+                    }
+                if (backing) {
+                    std::fseek(backing, tile_count * static_cast<long>(sizeof(texture_tile)), SEEK_SET);
+                    std::fwrite(&tile, sizeof(texture_tile), 1, backing);
+                }
+                tile_count++;
+                backing_size += ts*ts*3;
+            }
+        info.levels.push_back(level);
+    }
+
+    images.push_back(info);
+    return static_cast<int>(images.size()) - 1;
+}
+
+texture_cache::reader& texture_cache :: reader_for_this_thread() const {
+    thread_local uint64_t cached_owner = 0;
+    thread_local reader* cached = nullptr;
+    if (cached_owner == id)
+        return *cached;
+
+    std::lock_guard<std::mutex> lock(readers_mutex);
+    auto self = std::this_thread::get_id();
+    cached = nullptr;
+    for (auto& r : readers)
+        if (r->thread == self)
+            cached = r.get();
+    if (!cached) {
+        readers.push_back(std::unique_ptr<reader>(new reader));
+        cached = readers.back().get();
+        cached->thread = self;
+    }
+    cached_owner = id;
+    return *cached;
+}
+
+// Frees the tiles retired before the oldest epoch any thread is pinned at
+void texture_cache :: retire(std::vector<std::unique_ptr<texture_tile>>& tiles) const {
+    if (tiles.empty())
+        return;
+
+    std::lock_guard<std::mutex> lock(retired_mutex);
+    auto retired_epoch = epoch.fetch_add(1);
+    for (auto& t : tiles)
+        retired.emplace_back(retired_epoch, std::move(t));
+    tiles.clear();
+
+    uint64_t oldest = epoch.load();
+    {
+        std::lock_guard<std::mutex> readers_lock(readers_mutex);
+        for (const auto& r : readers) {
+            auto p = r->pinned.load();
+            if (p != 0)
+                oldest = std::min(oldest, p);
+        }
+    }
+    retired.erase(std::remove_if(retired.begin(), retired.end(),
+        [oldest](const std::pair<uint64_t, std::unique_ptr<texture_tile>>& t) { return t.first < oldest; }),
+        retired.end());
+}
+
+const texture_tile* texture_cache :: fetch_tile(reader& r, int handle, int level, int tx, int ty) const {
+    auto key = tile_key(handle, level, tx, ty);
+    auto hash = key ^ (key >> 17) ^ (key >> 34);
+
+    auto& slot = r.slots[hash % thread_slots];
+    if (slot.key == key && slot.epoch == r.current) {
+        r.hits.store(r.hits.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        return slot.tile;
+    }
+
+    auto& s = shards[hash % shard_count];
+    const texture_tile* found = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(s.m);
+        auto it = s.map.find(key);
+        if (it != s.map.end()) {
+            s.lru.splice(s.lru.begin(), s.lru, it->second);
+            s.hits++;
+            found = it->second->second.get();
+        } else {
+            s.misses++;
+        }
+    }
+
+    if (!found) {
+        // Miss: read the tile from the backing file outside the shard lock
+        std::unique_ptr<texture_tile> tile(new texture_tile);
+        const auto& info = images[handle].levels[level];
+        long index = info.first_tile + ty*info.tiles_x + tx;
+        {
+            std::lock_guard<std::mutex> lock(file_mutex);
+            if (!backing
+                || std::fseek(backing, index * static_cast<long>(sizeof(texture_tile)), SEEK_SET) != 0
+                || std::fread(tile.get(), sizeof(texture_tile), 1, backing) != 1)
+                std::fill(tile->texels, tile->texels + texture_tile::size*texture_tile::size*3, 0.0f);
+        }
+
+        std::vector<std::unique_ptr<texture_tile>> evicted;
+        {
+            std::lock_guard<std::mutex> lock(s.m);
+            auto it = s.map.find(key);
+            if (it != s.map.end()) {
+                found = it->second->second.get();   // another thread loaded it meanwhile
+            } else {
+                found = tile.get();
+                s.lru.emplace_front(key, std::move(tile));
+                s.map[key] = s.lru.begin();
+                s.evict_to(s.capacity, evicted);
+            }
+        }
+        retire(evicted);
+    }
+
+    slot.key = key;
+    slot.epoch = r.current;
+    slot.tile = found;
+    return found;
+}
+
+color texture_cache :: texel(int handle, int level, int x, int y) const {
+    const int ts = texture_tile::size;
+    pin p(*this);
+    auto tile = fetch_tile(p.r, handle, level, x / ts, y / ts);
+    auto t = tile->texels + ((y % ts)*ts + (x % ts))*3;
+    return color(t[0], t[1], t[2]);
+}
+
+color texture_cache :: bilinear(int handle, int level, double u, double v) const {
+    const int ts = texture_tile::size;
+    const auto& info = images[handle].levels[level];
+    pin p(*this);
+
+    // Texel centers sit at half-integer coordinates
+    auto x = clamp(u, 0.0, 1.0) * info.width - 0.5;
+    auto y = clamp(v, 0.0, 1.0) * info.height - 0.5;
+    auto fx = floor(x), fy = floor(y);
+    auto wx = x - fx, wy = y - fy;
+
+    int x0 = static_cast<int>(clamp(fx, 0, info.width-1)), x1 = static_cast<int>(clamp(fx+1, 0, info.width-1));
+    int y0 = static_cast<int>(clamp(fy, 0, info.height-1)), y1 = static_cast<int>(clamp(fy+1, 0, info.height-1));
+
+    // Usually all four texels come from one tile, fetched once
+    auto t = [&](int tx, int ty) {
+        auto tile = fetch_tile(p.r, handle, level, tx / ts, ty / ts);
+        auto q = tile->texels + ((ty % ts)*ts + (tx % ts))*3;
+        return color(q[0], q[1], q[2]);
+    };
+    if (x0/ts == x1/ts && y0/ts == y1/ts) {
+        auto tile = fetch_tile(p.r, handle, level, x0/ts, y0/ts);
+        auto same = [&](int tx, int ty) {
+            auto q = tile->texels + ((ty % ts)*ts + (tx % ts))*3;
+            return color(q[0], q[1], q[2]);
+        };
+        return (1-wy)*((1-wx)*same(x0, y0) + wx*same(x1, y0)) + wy*((1-wx)*same(x0, y1) + wx*same(x1, y1));
+    }
+
+    return (1-wy)*((1-wx)*t(x0, y0) + wx*t(x1, y0)) + wy*((1-wx)*t(x0, y1) + wx*t(x1, y1));
+}
+
+color texture_cache :: sample(int handle, double u, double v, double footprint) const {
+    const auto& info = images[handle];
+    int last = static_cast<int>(info.levels.size()) - 1;
+
+    // One pin covers both levels of a trilinear lookup
+    pin p(*this);
+
+    // Footprint in texels of the finest level decides the level
+    auto texels = footprint * std::max(info.levels[0].width, info.levels[0].height);
+    if (texels <= 1)
+        return bilinear(handle, 0, u, v);
+
+    auto lod = std::min(log2(texels), static_cast<double>(last));
+    int l0 = static_cast<int>(floor(lod));
+    int l1 = std::min(l0 + 1, last);
+    auto w = lod - l0;
+    if (w == 0 || l0 == l1)
+        return bilinear(handle, l0, u, v);
+    return (1-w)*bilinear(handle, l0, u, v) + w*bilinear(handle, l1, u, v);
+}
+
+size_t texture_cache :: resident_bytes() const {
+    size_t n = 0;
+    for (const auto& s : shards) {
+        std::lock_guard<std::mutex> lock(s.m);
+        n += s.lru.size() * sizeof(texture_tile);
+    }
+    return n;
+}
+
+size_t texture_cache :: hits() const {
+    size_t n = 0;
+    {
+        std::lock_guard<std::mutex> lock(readers_mutex);
+        for (const auto& r : readers)
+            n += r->hits.load(std::memory_order_relaxed);
+    }
+    for (const auto& s : shards) {
+        std::lock_guard<std::mutex> lock(s.m);
+        n += s.hits;
+    }
+    return n;
+}
+
+size_t texture_cache :: misses() const {
+    size_t n = 0;
+    for (const auto& s : shards) {
+        std::lock_guard<std::mutex> lock(s.m);
+        n += s.misses;
+    }
+    return n;
+}
+
+#endif
@@ -0,0 +1,175 @@
+#ifndef TEXTURE_PROGRAM_H
+#define TEXTURE_PROGRAM_H
+
+#include "general.h"
+
+#include "texture.h"
+
+#include <memory>
+#include <utility>
+#include <vector>
+
+// A texture tree lowered to a flat instruction array. Checkers become
+// conditional jumps, so nested checkers are evaluated in one loop instead of
+// a chain of virtual calls. Built by compile_texture().
+class texture_program : public texture {
+    public:
+        enum opcode {
+            op_constant,    // return constants[arg]
+            op_checker,     // jump to arg if the checker at scale is odd, else fall through
+            op_noise,       // return the noise_texture tex
+            op_image,       // return the image_texture tex
+            op_texture      // any other texture, called through its vtable
+        };
+
+        struct instruction {
+            opcode op;
+            int arg;
+            double scale;           // checker scale divided by pi
+            const texture* tex;
+        };
+
+        virtual color value(double u, double v, const point3& p) const override {
+            return value(u, v, p, 0);
+        }
+
+        virtual color value(double u, double v, const point3& p, double footprint) const override;
+
+        // sin(s*x)*sin(s*y)*sin(s*z) < 0 without the sines: sin(a) is negative
+        // exactly when floor(a/pi) is odd.
+        static bool checker_odd(const point3& p, double scale_over_pi) {
+            auto cells = vfloor(p.simd() * f64x4(scale_over_pi));
+            return static_cast<long long>(cells.hsum3()) & 1;
+        }
+
+    public:
+        std::vector<instruction> code;
+        std::vector<color> constants;
+        std::vector<shared_ptr<texture>> leaves;   // keeps tex pointers alive
+};
+
+color texture_program :: value(double u, double v, const point3& p, double footprint) const {
+    int pc = 0;
+    while (true) {
+        const auto& in = code[pc];
+        switch (in.op) {
+            case op_constant:
+                return constants[in.arg];
+            case op_checker:
+                pc = checker_odd(p, in.scale) ? in.arg : pc + 1;
+                break;
+            case op_noise:
+                return static_cast<const noise_texture*>(in.tex)->noise_texture::value(u, v, p);
+            case op_image:
+                return static_cast<const image_texture*>(in.tex)->sample(u, v, footprint);
+            default:
+                return in.tex->value(u, v, p, footprint);
+        }
+    }
+}
+
+namespace texture_compiler {
+    // Folded texture tree, the intermediate form between texture and program
+    struct node {
+        texture_program::opcode op;
+        color c;
+        double scale = 0;
+        shared_ptr<texture> tex;
+        std::unique_ptr<node> even, odd;
+    };
+
+    // known holds the parity of every checker scale already decided on the way
+    // down; a nested checker with the same scale always takes the same branch.
+    inline std::unique_ptr<node> fold(
+        const shared_ptr<texture>& t, std::vector<std::pair<double, bool>>& known
+    ) {
+        std::unique_ptr<node> n(new node);
+        n->tex = t;
+
+        if (auto s = std::dynamic_pointer_cast<solid_color>(t)) {
+            n->op = texture_program::op_constant;
+            n->c = s->color_value;
+            return n;
+        }
+
+        if (auto ch = std::dynamic_pointer_cast<checker_texture>(t)) {
+            double scale = ch->scale;
+            for (const auto& k : known)
+                if (k.first == scale)
+                    return fold(k.second ? ch->odd : ch->even, known);
+
+            known.emplace_back(scale, false);
+            auto even = fold(ch->even, known);
+            known.back().second = true;
+            auto odd = fold(ch->odd, known);
+            known.pop_back();
+
+            // Both branches give the same constant
+            if (even->op == texture_program::op_constant && odd->op == texture_program::op_constant
+                && even->c.x() == odd->c.x() && even->c.y() == odd->c.y() && even->c.z() == odd->c.z())
+                return even;
+
+            n->op = texture_program::op_checker;
+            n->scale = scale;
+            n->even = std::move(even);
+            n->odd = std::move(odd);
+            return n;
+        }
+
+        if (std::dynamic_pointer_cast<noise_texture>(t))
+            n->op = texture_program::op_noise;
+        else if (std::dynamic_pointer_cast<image_texture>(t))
+            n->op = texture_program::op_image;
+        else
+            n->op = texture_program::op_texture;
+        return n;
+    }
+
+    // Even branch directly follows its checker; the odd branch is the jump target
+    inline void emit(const node& n, texture_program& prog) {
+        texture_program::instruction in{n.op, 0, 0, n.tex.get()};
+
+        switch (n.op) {
+            case texture_program::op_constant:
+                in.arg = static_cast<int>(prog.constants.size());
+                prog.constants.push_back(n.c);
+                prog.code.push_back(in);
+                return;
+            case texture_program::op_checker: {
+                in.scale = n.scale / pi;
+                auto at = prog.code.size();
+                prog.code.push_back(in);
+                emit(*n.even, prog);
+                prog.code[at].arg = static_cast<int>(prog.code.size());
+                emit(*n.odd, prog);
+                return;
+            }
+            default:
+                prog.leaves.push_back(n.tex);
+                prog.code.push_back(in);
+                return;
+        }
+    }
+}
+
+// Lowers t into a texture_program with constants folded. Textures that gain
+// nothing from it (a single leaf) are returned unchanged, and trees that fold
+// to one color become a solid_color.
+inline shared_ptr<texture> compile_texture(const shared_ptr<texture>& t) {
+    if (!t)
+        return t;
+
+    std::vector<std::pair<double, bool>> known;
+    auto root = texture_compiler::fold(t, known);
+
+    if (root->op == texture_program::op_constant)
+        return std::dynamic_pointer_cast<solid_color>(t) ? t : make_scene_shared<solid_color>(root->c);
+    if (root->op != texture_program::op_checker)
+        return root->tex;
+
+    auto prog = make_scene_shared<texture_program>();
+    texture_compiler::emit(*root, *prog);
+    return prog;
+}
+
+#endif
@@ -0,0 +1,73 @@
+#ifndef TEXTURE_REGISTRY_H
+#define TEXTURE_REGISTRY_H
+
+#include "general.h"
+
+#include "texture.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Shared image textures keyed by path. Scenes ask for a texture by path and get
+// the same handle every time; the file is decoded once, and all textures
+// requested during scene construction are decoded concurrently by load_pending().
+class texture_registry {
+    public:
+        static texture_registry& global() {
+            static texture_registry registry;
+            return registry;
+        }
+
+        // Returns the texture for path. New paths are queued for load_pending();
+        // until then the texture renders as the missing-texture cyan.
+        shared_ptr<image_texture> get(const std::string& path) {
+            std::lock_guard<std::mutex> lock(m);
+            auto it = textures.find(path);
+            if (it != textures.end())
+                return it->second;
+
+            auto tex = make_shared<image_texture>();
+            textures[path] = tex;
+            pending.push_back(path);
+            return tex;
+        }
+
+        // Decodes every texture queued since the last call on a thread pool
+        void load_pending(unsigned thread_count = 0) {
+            std::vector<std::string> paths;
+            {
+                std::lock_guard<std::mutex> lock(m);
+                paths.swap(pending);
+            }
+            if (paths.empty())
+                return;
+
+            thread_pool pool(std::min<unsigned>(
+                thread_count ? thread_count : thread_pool::default_thread_count(),
+                static_cast<unsigned>(paths.size())));
+
+            std::vector<std::future<void>> done;
+            for (const auto& path : paths) {
+                auto tex = get(path);
+                done.push_back(pool.submit([tex, path]{ tex->load(path.c_str()); }));
+            }
+            for (auto& f : done)
+                f.get();
+        }
+
+        size_t size() const {
+            std::lock_guard<std::mutex> lock(m);
+            return textures.size();
+        }
+
+    private:
+        mutable std::mutex m;
+        std::unordered_map<std::string, shared_ptr<image_texture>> textures;
+        std::vector<std::string> pending;
+};
+
+#endif
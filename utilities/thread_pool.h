@@ -0,0 +1,81 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads pulling tasks from a shared queue
+class thread_pool {
+    public:
+        explicit thread_pool(unsigned thread_count = 0) {
+            if (thread_count == 0)
+                thread_count = default_thread_count();
+            for (unsigned i=0;i<thread_count;i++)
+                workers.emplace_back([this]{ work(); });
+        }
+
+        ~thread_pool() {
+            {
+                std::lock_guard<std::mutex> lock(m);
+                stopping = true;
+            }
+            cv.notify_all();
+            for (auto& t : workers)
+                t.join();
+        }
+
+        thread_pool(const thread_pool&) = delete;
+        thread_pool& operator=(const thread_pool&) = delete;
+
+        static unsigned default_thread_count() {
+            auto n = std::thread::hardware_concurrency();
+            return n ? n : 1;
+        }
+
+        unsigned size() const { return static_cast<unsigned>(workers.size()); }
+
+        // Queues f and returns a future for its result
+        template <typename F>
+        auto submit(F&& f) -> std::future<decltype(f())> {
+            typedef decltype(f()) result_type;
+            auto task = std::make_shared<std::packaged_task<result_type()>>(std::forward<F>(f));
+            auto result = task->get_future();
+            {
+                std::lock_guard<std::mutex> lock(m);
+                tasks.emplace_back([task]{ (*task)(); });
+            }
+            cv.notify_one();
+            return result;
+        }
+
+    private:
+        void work() {
+            while (true) {
+                std::function<void()> task;
+                {
+                    std::unique_lock<std::mutex> lock(m);
+                    cv.wait(lock, [this]{ return stopping || !tasks.empty(); });
+                    if (tasks.empty())
+                        return;
+                    task = std::move(tasks.front());
+                    tasks.pop_front();
+                }
+                task();
+            }
+        }
+
+    private:
+        std::vector<std::thread> workers;
+        std::deque<std::function<void()>> tasks;
+        std::mutex m;
+        std::condition_variable cv;
+        bool stopping = false;
+};
+
+#endif
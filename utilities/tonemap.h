@@ -0,0 +1,50 @@
+#ifndef TONEMAP_H
+#define TONEMAP_H
+
+#include "general.h"
+
+#include <string>
+
+// Maps linear radiance into [0, 1] before display encoding. The 8-bit writers
+// apply the gamma afterwards.
+enum class tonemap_operator { clamp, reinhard, aces };
+
+struct tonemap_settings {
+    double exposure = 0;    // in stops
+    tonemap_operator op = tonemap_operator::clamp;
+};
+
+inline bool parse_tonemap_operator(const std::string& name, tonemap_operator& op) {
+    if (name == "clamp")
+        op = tonemap_operator::clamp;
+    else if (name == "reinhard")
+        op = tonemap_operator::reinhard;
+    else if (name == "aces")
+        op = tonemap_operator::aces;
+    else
+        return false;
+    return true;
+}
+
+inline double tonemap_channel(double x, tonemap_operator op) {
+    x = fmax(x, 0.0);
+    switch (op) {
+        case tonemap_operator::reinhard:
+            return x / (1 + x);
+        case tonemap_operator::aces:
+            // Narkowicz's fit of the ACES filmic curve
+            return clamp((x*(2.51*x + 0.03)) / (x*(2.43*x + 0.59) + 0.14), 0.0, 1.0);
+        default:
+            return fmin(x, 1.0);
+    }
+}
+
+inline color tonemap(const color& c, const tonemap_settings& settings) {
+    auto scale = exp2(settings.exposure);
+    return color(
+        tonemap_channel(scale*c.x(), settings.op),
+        tonemap_channel(scale*c.y(), settings.op),
+        tonemap_channel(scale*c.z(), settings.op));
+}
+
+#endif
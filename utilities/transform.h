@@ -0,0 +1,350 @@
+#ifndef TRANSFORM_H
+#define TRANSFORM_H
+
+#include "general.h"
+
+#include "hittable.h"
+#include "hittable_list.h"
+#include "sphere.h"
+#include "moving_sphere.h"
+#include "aarect.h"
+#include "box.h"
+#include "bvh.h"
+
+#include <unordered_map>
+
+// Affine map stored as a 3x4 matrix: the left 3x3 block is the linear part and
+// the last column is the translation.
+class affine {
+    public:
+        affine() : m{{1, 0, 0, 0}, {0, 1, 0, 0}, {0, 0, 1, 0}} {}
+
+        static affine translation(const vec3& offset) {
+            affine a;
+            a.m[0][3] = offset.x();
+            a.m[1][3] = offset.y();
+            a.m[2][3] = offset.z();
+            return a;
+        }
+
+        // Rotation around the y-axis, same convention as rotate_y
+        static affine rotation_y(double angle) {
+            auto radians = degrees_to_radians(angle);
+            return rotation_y(cos(radians), sin(radians));
+        }
+
+        static affine rotation_y(double cos_theta, double sin_theta) {
+            affine a;
+            a.m[0][0] = cos_theta;  a.m[0][2] = sin_theta;
+            a.m[2][0] = -sin_theta; a.m[2][2] = cos_theta;
+            return a;
+        }
+
+        // Rotation by angle degrees around an arbitrary axis (Rodrigues)
+        static affine rotation(const vec3& axis, double angle) {
+            auto k = unit_vector(axis);
+            auto radians = degrees_to_radians(angle);
+            auto c = cos(radians), s = sin(radians), t = 1 - c;
+            affine a;
+            a.m[0][0] = t*k.x()*k.x() + c;       a.m[0][1] = t*k.x()*k.y() - s*k.z(); a.m[0][2] = t*k.x()*k.z() + s*k.y();
+            a.m[1][0] = t*k.x()*k.y() + s*k.z(); a.m[1][1] = t*k.y()*k.y() + c;       a.m[1][2] = t*k.y()*k.z() - s*k.x();
+            a.m[2][0] = t*k.x()*k.z() - s*k.y(); a.m[2][1] = t*k.y()*k.z() + s*k.x(); a.m[2][2] = t*k.z()*k.z() + c;
+            return a;
+        }
+
+        static affine scaling(const vec3& s) {
+            affine a;
+            a.m[0][0] = s.x();
+            a.m[1][1] = s.y();
+            a.m[2][2] = s.z();
+            return a;
+        }
+
+        point3 apply_point(const point3& p) const {
+            return point3(
+                m[0][0]*p.x() + m[0][1]*p.y() + m[0][2]*p.z() + m[0][3],
+                m[1][0]*p.x() + m[1][1]*p.y() + m[1][2]*p.z() + m[1][3],
+                m[2][0]*p.x() + m[2][1]*p.y() + m[2][2]*p.z() + m[2][3]
+            );
+        }
+
+        vec3 apply_vector(const vec3& v) const {
+            return vec3(
+                m[0][0]*v.x() + m[0][1]*v.y() + m[0][2]*v.z(),
+                m[1][0]*v.x() + m[1][1]*v.y() + m[1][2]*v.z(),
+                m[2][0]*v.x() + m[2][1]*v.y() + m[2][2]*v.z()
+            );
+        }
+
+        // Multiplies by the transpose of the linear part. Called on the inverse
+        // transform this maps normals from object to world space.
+        vec3 apply_transposed(const vec3& n) const {
+            return vec3(
+                m[0][0]*n.x() + m[1][0]*n.y() + m[2][0]*n.z(),
+                m[0][1]*n.x() + m[1][1]*n.y() + m[2][1]*n.z(),
+                m[0][2]*n.x() + m[1][2]*n.y() + m[2][2]*n.z()
+            );
+        }
+
+        // Composition: (a * b) applies b first, then a
+        friend affine operator*(const affine& a, const affine& b) {
+            affine r;
+            for (int i=0;i<3;i++){
+                for (int j=0;j<4;j++){
+                    r.m[i][j] = a.m[i][0]*b.m[0][j] + a.m[i][1]*b.m[1][j] + a.m[i][2]*b.m[2][j];
+                }
+                r.m[i][3] += a.m[i][3];
+            }
+            return r;
+        }
+
+        affine inverse() const {
+            auto det = m[0][0]*(m[1][1]*m[2][2] - m[1][2]*m[2][1])
+                     - m[0][1]*(m[1][0]*m[2][2] - m[1][2]*m[2][0])
+                     + m[0][2]*(m[1][0]*m[2][1] - m[1][1]*m[2][0]);
+            auto inv_det = 1 / det;
+
+            affine r;
+            r.m[0][0] =  (m[1][1]*m[2][2] - m[1][2]*m[2][1]) * inv_det;
+            r.m[0][1] = -(m[0][1]*m[2][2] - m[0][2]*m[2][1]) * inv_det;
+            r.m[0][2] =  (m[0][1]*m[1][2] - m[0][2]*m[1][1]) * inv_det;
+            r.m[1][0] = -(m[1][0]*m[2][2] - m[1][2]*m[2][0]) * inv_det;
+            r.m[1][1] =  (m[0][0]*m[2][2] - m[0][2]*m[2][0]) * inv_det;
+            r.m[1][2] = -(m[0][0]*m[1][2] - m[0][2]*m[1][0]) * inv_det;
+            r.m[2][0] =  (m[1][0]*m[2][1] - m[1][1]*m[2][0]) * inv_det;
+            r.m[2][1] = -(m[0][0]*m[2][1] - m[0][1]*m[2][0]) * inv_det;
+            r.m[2][2] =  (m[0][0]*m[1][1] - m[0][1]*m[1][0]) * inv_det;
+
+            auto t = r.apply_vector(vec3(m[0][3], m[1][3], m[2][3]));
+            r.m[0][3] = -t.x();
+            r.m[1][3] = -t.y();
+            r.m[2][3] = -t.z();
+            return r;
+        }
+
+        vec3 offset() const { return vec3(m[0][3], m[1][3], m[2][3]); }
+
+        // True if the linear part is s times the identity
+        bool is_uniform_scale(double& s) const {
+            s = m[0][0];
+            return m[1][1] == s && m[2][2] == s
+                && m[0][1] == 0 && m[0][2] == 0 && m[1][0] == 0
+                && m[1][2] == 0 && m[2][0] == 0 && m[2][1] == 0;
+        }
+
+        // Box enclosing the transformed corners of b
+        aabb apply_box(const aabb& b) const {
+            vec3 min(infinity, infinity, infinity);
+            vec3 max(-infinity, -infinity, -infinity);
+
+            for (int i=0;i<2;i++){
+                for (int j=0;j<2;j++){
+                    for (int k=0;k<2;k++){
+                        auto corner = apply_point(point3(
+                            i ? b.max().x() : b.min().x(),
+                            j ? b.max().y() : b.min().y(),
+                            k ? b.max().z() : b.min().z()
+                        ));
+                        min = vmin(min, corner);
+                        max = vmax(max, corner);
+                    }
+                }
+            }
+            return aabb(min, max);
+        }
+
+    public:
+        double m[3][4];
+};
+
+// Instance of an object placed in the world by an arbitrary affine transform.
+// Rays are moved into object space once; hit points and normals are moved back.
+class transform : public hittable {
+    public:
+        transform(shared_ptr<hittable> p, const affine& object_to_world)
+            : h_ptr(p), to_world(object_to_world), to_object(object_to_world.inverse()) {}
+
+        virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override;
+
+        virtual bool bounding_box(double time0, double time1, aabb& output_bounding_box) const override {
+            if (!h_ptr->bounding_box(time0, time1, output_bounding_box))
+                return false;
+            output_bounding_box = to_world.apply_box(output_bounding_box);
+            return true;
+        }
+
+        virtual bool motion_bounding_box(double time0, double time1, aabb& box_start, aabb& box_end) const override {
+            if (!h_ptr->motion_bounding_box(time0, time1, box_start, box_end))
+                return false;
+            box_start = to_world.apply_box(box_start);
+            box_end = to_world.apply_box(box_end);
+            return true;
+        }
+
+    public:
+        shared_ptr<hittable> h_ptr;
+        affine to_world;
+        affine to_object;
+};
+
+bool transform :: hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
+    RT_STAT_INC(transform_tests);
+    // The direction is not renormalized, so t is the same in both spaces. The
+    // cone width is rescaled to object units along the ray; the spread term
+    // already scales with the transformed direction's length.
+    auto object_direction = to_object.apply_vector(r.direction());
+    auto scale = object_direction.length() / r.direction().length();
+    ray object_r(to_object.apply_point(r.origin()), object_direction, r.time(),
+                 r.cone_width * scale, r.cone_spread);
+    if (!h_ptr->hit(object_r, t_min, t_max, rec))
+        return false;
+
+    // The inverse transpose keeps the normal on the same side as the ray, so
+    // front_face from the object-space hit still holds
+    rec.p = to_world.apply_point(rec.p);
+    rec.normal = unit_vector(to_object.apply_transposed(rec.normal));
+
+    return true;
+}
+
+// Bakes a transform into the primitive itself when the result is the same
+// primitive type and looks identical (no rotation, so uv mappings are kept).
+// Returns nullptr when it can't.
+shared_ptr<hittable> bake_transform(const shared_ptr<hittable>& object, const affine& a) {
+    double s;
+    if (!a.is_uniform_scale(s))
+        return nullptr;
+
+    auto t = a.offset();
+
+    if (auto sp = std::dynamic_pointer_cast<sphere>(object)) {
+        if (s <= 0) return nullptr;
+        return make_scene_shared<sphere>(a.apply_point(sp->center), s*sp->radius, sp->mat_ptr);
+    }
+
+    if (auto ms = std::dynamic_pointer_cast<moving_sphere>(object)) {
+        if (s <= 0) return nullptr;
+        return make_scene_shared<moving_sphere>(
+            a.apply_point(ms->center0), a.apply_point(ms->center1), ms->time0, ms->time1, s*ms->radius, ms->mat_ptr);
+    }
+
+    // Rects and boxes keep their axis-aligned form only under translation
+    if (s != 1)
+        return nullptr;
+
+    if (auto xy = std::dynamic_pointer_cast<xy_rect>(object))
+        return make_scene_shared<xy_rect>(xy->x0+t.x(), xy->x1+t.x(), xy->y0+t.y(), xy->y1+t.y(), xy->k+t.z(), xy->mat_ptr);
+
+    if (auto xz = std::dynamic_pointer_cast<xz_rect>(object))
+        return make_scene_shared<xz_rect>(xz->x0+t.x(), xz->x1+t.x(), xz->z0+t.z(), xz->z1+t.z(), xz->k+t.y(), xz->mat_ptr);
+
+    if (auto yz = std::dynamic_pointer_cast<yz_rect>(object))
+        return make_scene_shared<yz_rect>(yz->y0+t.y(), yz->y1+t.y(), yz->z0+t.z(), yz->z1+t.z(), yz->k+t.x(), yz->mat_ptr);
+
+    if (auto bx = std::dynamic_pointer_cast<box>(object))
+        return make_scene_shared<box>(bx->box_min + t, bx->box_max + t, bx->mat_ptr);
+
+    return nullptr;
+}
+
+// Scene build pass: collapses chains of translate / rotate_y / transform into a
+// single transform node with one composed matrix, bakes static transforms over
+// simple primitives straight into world space, and recurses into lists and BVHs.
+shared_ptr<hittable> flatten_transforms(const shared_ptr<hittable>& object) {
+    affine a;
+    auto inner = object;
+
+    while (true) {
+        if (auto tr = std::dynamic_pointer_cast<translate>(inner)) {
+            a = a * affine::translation(tr->offset);
+            inner = tr->h_ptr;
+        } else if (auto ro = std::dynamic_pointer_cast<rotate_y>(inner)) {
+            a = a * affine::rotation_y(ro->cos_theta, ro->sin_theta);
+            inner = ro->h_ptr;
+        } else if (auto tf = std::dynamic_pointer_cast<transform>(inner)) {
+            a = a * tf->to_world;
+            inner = tf->h_ptr;
+        } else {
+            break;
+        }
+    }
+
+    bool transformed = inner != object;
+
+    if (auto list = std::dynamic_pointer_cast<hittable_list>(inner)) {
+        auto flat = make_scene_shared<hittable_list>();
+        for (const auto& child : list->objects)
+            flat->add(flatten_transforms(child));
+        inner = flat;
+    } else if (auto node = std::dynamic_pointer_cast<bvh_node>(inner)) {
+        // Same geometry, so the node's bounds stay valid
+        auto old_left = node->left;
+        node->left = flatten_transforms(old_left);
+        node->right = node->right == old_left ? node->left : flatten_transforms(node->right);
+    }
+
+    if (!transformed)
+        return inner;
+
+    if (auto baked = bake_transform(inner, a))
+        return baked;
+
+    return make_scene_shared<transform>(inner, a);
+}
+
+void flatten_transforms(hittable_list& world) {
+    for (auto& object : world.objects)
+        object = flatten_transforms(object);
+}
+
+// Scene build pass for compressed_bvh: rebuilds every bvh_node tree in the
+// scene, including those under transforms, as a compressed_bvh over the same
+// objects. Nested BVHs are merged into the one containing them. done maps each
+// visited object to its result, so subtrees shared by several instances are
+// compressed once and stay shared.
+typedef std::unordered_map<const hittable*, shared_ptr<hittable>> compressed_objects;
+
+shared_ptr<hittable> compress_bvhs(const shared_ptr<hittable>& object, compressed_objects& done);
+
+void collect_bvh_objects(const shared_ptr<hittable>& object, hittable_list& objects, compressed_objects& done) {
+    auto node = std::dynamic_pointer_cast<bvh_node>(object);
+    if (!node) {
+        objects.add(compress_bvhs(object, done));
+        return;
+    }
+    collect_bvh_objects(node->left, objects, done);
+    if (node->right != node->left)
+        collect_bvh_objects(node->right, objects, done);
+}
+
+shared_ptr<hittable> compress_bvhs(const shared_ptr<hittable>& object, compressed_objects& done) {
+    auto found = done.find(object.get());
+    if (found != done.end())
+        return found->second;
+
+    auto result = object;
+    if (auto node = std::dynamic_pointer_cast<bvh_node>(object)) {
+        hittable_list objects;
+        collect_bvh_objects(node, objects, done);
+        result = make_scene_shared<compressed_bvh>(objects, node->time0, node->time1);
+    } else if (auto tr = std::dynamic_pointer_cast<translate>(object))
+        tr->h_ptr = compress_bvhs(tr->h_ptr, done);
+    else if (auto ro = std::dynamic_pointer_cast<rotate_y>(object))
+        ro->h_ptr = compress_bvhs(ro->h_ptr, done);
+    else if (auto tf = std::dynamic_pointer_cast<transform>(object))
+        tf->h_ptr = compress_bvhs(tf->h_ptr, done);
+    else if (auto list = std::dynamic_pointer_cast<hittable_list>(object))
+        for (auto& child : list->objects)
+            child = compress_bvhs(child, done);
+
+    done[object.get()] = result;
+    return result;
+}
+
+void compress_bvhs(hittable_list& world) {
+    compressed_objects done;
+    for (auto& object : world.objects)
+        object = compress_bvhs(object, done);
+}
+
+#endif
@@ -1,18 +1,26 @@
 #ifndef VEC3_H
 #define VEC3_H
 
+#include "simd.h"
+
 #include <iostream>
 #include <cmath>
 
 using std::sqrt;
 
-class vec3{
+// 3D vector padded to four lanes so every operation maps onto one packed
+// SIMD instruction. The fourth lane starts at zero but is not guaranteed to
+// stay there (0 * inf is NaN), so reductions leave it out.
+class alignas(32) vec3{
     public:
-        double e[3];
+        double e[4];
 
     public:
-        vec3() : e{0, 0, 0}{};
-        vec3(double e0, double e1, double e2) : e{e0, e1, e2} {};
+        vec3() : e{0, 0, 0, 0}{};
+        vec3(double e0, double e1, double e2) : e{e0, e1, e2, 0} {};
+        vec3(const f64x4& v) { v.store(e); }
+
+        f64x4 simd() const { return f64x4::load(e); }
 
         // const after func name means it can't change member variables 
 
@@ -20,7 +28,7 @@ class vec3{
         double y() const { return e[1]; }
         double z() const { return e[2]; }
 
-        vec3 operator-() const { return vec3(-e[0], -e[1], e[2]); }
+        vec3 operator-() const { return vec3(-simd()); }
         
         // Returns e[i]
         double operator[](int i) const { return e[i]; } 
@@ -29,16 +37,12 @@ class vec3{
         double& operator[](int i) { return e[i]; }
 
         vec3& operator+=(const vec3 &v){
-            e[0] += v[0];
-            e[1] += v[1];
-            e[2] += v[2];
+            (simd() + v.simd()).store(e);
             return *this;
         }
 
         vec3& operator*=(const double t){
-            e[0] *= t;
-            e[1] *= t;
-            e[2] *= t;
+            (simd() * f64x4(t)).store(e);
             return *this;
         }
 
@@ -51,7 +55,7 @@ class vec3{
         }
 
         double length_squared() const {
-            return e[0]*e[0]+e[1]*e[1]+e[2]*e[2];
+            return (simd() * simd()).hsum3();
         }
 
         inline static vec3 random() {
@@ -82,19 +86,19 @@ inline std::ostream& operator<<(std::ostream& out, const vec3 &v){
 }
 
 inline vec3 operator+(const vec3 &u, const vec3 &v){
-    return vec3(u.e[0]+v.e[0], u.e[1]+v.e[1], u.e[2]+v.e[2]);
+    return vec3(u.simd() + v.simd());
 }
 
 inline vec3 operator-(const vec3 &u, const vec3 &v){
-    return vec3(u.e[0]-v.e[0], u.e[1]-v.e[1], u.e[2]-v.e[2]);
+    return vec3(u.simd() - v.simd());
 }
 
 inline vec3 operator*(const vec3 &u, const vec3 &v){
-    return vec3(u.e[0]*v.e[0], u.e[1]*v.e[1], u.e[2]*v.e[2]);
+    return vec3(u.simd() * v.simd());
 }
 
 inline vec3 operator*(double t, const vec3 &u){
-    return vec3(t*u.e[0], t*u.e[1], t*u.e[2]);
+    return vec3(f64x4(t) * u.simd());
 }
 
 inline vec3 operator*(const vec3 &v, double t){
@@ -106,15 +110,22 @@ inline vec3 operator/(const vec3 &v, double t){
 }
 
 inline double dot(const vec3 &v, const vec3 &u){
-    return v.e[0]*u.e[0]
-          +v.e[1]*u.e[1]
-          +v.e[2]*u.e[2];
+    return (v.simd() * u.simd()).hsum3();
 }
 
 inline vec3 cross(const vec3 &u, const vec3 &v){
-    return vec3(u.e[1] * v.e[2] - u.e[2] * v.e[1],
-                u.e[2] * v.e[0] - u.e[0] * v.e[2],
-                u.e[0] * v.e[1] - u.e[1] * v.e[0]);
+    auto a = u.simd();
+    auto b = v.simd();
+    return vec3(a.yzxw() * b.zxyw() - a.zxyw() * b.yzxw());
+}
+
+// Component-wise minimum and maximum
+inline vec3 vmin(const vec3 &u, const vec3 &v){
+    return vec3(vmin(u.simd(), v.simd()));
+}
+
+inline vec3 vmax(const vec3 &u, const vec3 &v){
+    return vec3(vmax(u.simd(), v.simd()));
 }
 
 inline vec3 unit_vector(vec3 v){